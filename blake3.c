@@ -0,0 +1,548 @@
+/*
+   Copyright (c) 2011 Gluster, Inc. <http://www.gluster.com>
+   This file is part of GlusterFS.
+
+   GlusterFS is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Affero General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   GlusterFS is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Affero General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+/* BLAKE3, unkeyed with a 32 byte output, for the blake3 permits. the
+   compression is plain portable C after the reference implementation.
+
+   the input is a binary tree of 1K chunks, the left subtree always the
+   largest power of two of chunks. every chunk is hashed with its own
+   counter, so that aligned subtrees of a big file can go to one thread
+   each and only their chaining values are merged at the end.
+*/
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+
+#define BLAKE3_OUT_LEN     32
+#define BLAKE3_BLOCK_LEN   64
+#define BLAKE3_CHUNK_LEN   1024
+#define BLAKE3_MAX_DEPTH   54
+
+#define BLAKE3_CHUNK_START (1 << 0)
+#define BLAKE3_CHUNK_END   (1 << 1)
+#define BLAKE3_PARENT      (1 << 2)
+#define BLAKE3_ROOT        (1 << 3)
+
+
+static const uint32_t blake3_iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+
+/* the message words each round takes, the permutation applied ahead */
+static const uint8_t blake3_schedule[7][16] = {
+        {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+        {  2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8 },
+        {  3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1 },
+        { 10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6 },
+        { 12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4 },
+        {  9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7 },
+        { 11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13 },
+};
+
+
+#define ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define G(a, b, c, d, x, y)                                     \
+        do {                                                    \
+                s[a] = s[a] + s[b] + (x);                       \
+                s[d] = ROTR (s[d] ^ s[a], 16);                  \
+                s[c] = s[c] + s[d];                             \
+                s[b] = ROTR (s[b] ^ s[c], 12);                  \
+                s[a] = s[a] + s[b] + (y);                       \
+                s[d] = ROTR (s[d] ^ s[a], 8);                   \
+                s[c] = s[c] + s[d];                             \
+                s[b] = ROTR (s[b] ^ s[c], 7);                   \
+        } while (0)
+
+#define ROUND(r)                                                        \
+        do {                                                            \
+                const uint8_t *k = blake3_schedule[r];                  \
+                G (0, 4,  8, 12, m[k[0]],  m[k[1]]);                    \
+                G (1, 5,  9, 13, m[k[2]],  m[k[3]]);                    \
+                G (2, 6, 10, 14, m[k[4]],  m[k[5]]);                    \
+                G (3, 7, 11, 15, m[k[6]],  m[k[7]]);                    \
+                G (0, 5, 10, 15, m[k[8]],  m[k[9]]);                    \
+                G (1, 6, 11, 12, m[k[10]], m[k[11]]);                   \
+                G (2, 7,  8, 13, m[k[12]], m[k[13]]);                   \
+                G (3, 4,  9, 14, m[k[14]], m[k[15]]);                   \
+        } while (0)
+
+
+static uint32_t
+blake3_load32 (const uint8_t *p)
+{
+        return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+                ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+/* the full 16 word output of compressing one block */
+static void
+blake3_compress (const uint32_t cv[8], const uint8_t block[BLAKE3_BLOCK_LEN],
+                 uint8_t len, uint64_t counter, uint8_t flags, uint32_t s[16])
+{
+        uint32_t m[16];
+        int      i = 0;
+
+        for (i = 0; i < 16; i++)
+                m[i] = blake3_load32 (block + 4 * i);
+
+        memcpy (s, cv, 8 * sizeof (uint32_t));
+        memcpy (s + 8, blake3_iv, 4 * sizeof (uint32_t));
+        s[12] = (uint32_t) counter;
+        s[13] = (uint32_t) (counter >> 32);
+        s[14] = len;
+        s[15] = flags;
+
+        /* spelt out, so that every message index is a constant */
+        ROUND (0);
+        ROUND (1);
+        ROUND (2);
+        ROUND (3);
+        ROUND (4);
+        ROUND (5);
+        ROUND (6);
+
+        for (i = 0; i < 8; i++) {
+                s[i] ^= s[i + 8];
+                s[i + 8] ^= cv[i];
+        }
+}
+
+#undef ROUND
+#undef G
+#undef ROTR
+
+
+/* what a chunk or parent node still has to be compressed into, kept
+   until it is known whether it is the root */
+struct blake3_output {
+        uint32_t  cv[8];
+        uint8_t   block[BLAKE3_BLOCK_LEN];
+        uint8_t   len;
+        uint8_t   flags;
+        uint64_t  counter;
+};
+
+
+struct blake3_chunk {
+        uint32_t  cv[8];
+        uint64_t  counter;
+        uint8_t   block[BLAKE3_BLOCK_LEN];
+        uint8_t   len;
+        uint8_t   compressed;           /* blocks so far */
+};
+
+
+typedef struct {
+        struct blake3_chunk  chunk;
+        uint32_t             stack[BLAKE3_MAX_DEPTH][8];
+        unsigned int         depth;
+} blake3_ctx;
+
+
+static void
+blake3_output_cv (const struct blake3_output *out, uint32_t cv[8])
+{
+        uint32_t s[16];
+
+        blake3_compress (out->cv, out->block, out->len, out->counter,
+                         out->flags, s);
+        memcpy (cv, s, 8 * sizeof (uint32_t));
+}
+
+
+static void
+blake3_chunk_init (struct blake3_chunk *chunk, uint64_t counter)
+{
+        memset (chunk, 0, sizeof (*chunk));
+        memcpy (chunk->cv, blake3_iv, sizeof (blake3_iv));
+        chunk->counter = counter;
+}
+
+
+static size_t
+blake3_chunk_bytes (const struct blake3_chunk *chunk)
+{
+        return BLAKE3_BLOCK_LEN * chunk->compressed + chunk->len;
+}
+
+
+static uint8_t
+blake3_chunk_start (const struct blake3_chunk *chunk)
+{
+        return chunk->compressed ? 0 : BLAKE3_CHUNK_START;
+}
+
+
+static void
+blake3_chunk_update (struct blake3_chunk *chunk, const uint8_t *p, size_t len)
+{
+        uint32_t s[16];
+        size_t   n = 0;
+
+        while (len) {
+                /* a full block is only compressed once more follows */
+                if (chunk->len == BLAKE3_BLOCK_LEN) {
+                        blake3_compress (chunk->cv, chunk->block,
+                                         BLAKE3_BLOCK_LEN, chunk->counter,
+                                         blake3_chunk_start (chunk), s);
+                        memcpy (chunk->cv, s, sizeof (chunk->cv));
+                        chunk->compressed++;
+                        chunk->len = 0;
+                        memset (chunk->block, 0, sizeof (chunk->block));
+                }
+
+                n = BLAKE3_BLOCK_LEN - chunk->len;
+                if (n > len)
+                        n = len;
+                memcpy (chunk->block + chunk->len, p, n);
+                chunk->len += n;
+                p += n;
+                len -= n;
+        }
+}
+
+
+static void
+blake3_chunk_output (const struct blake3_chunk *chunk,
+                     struct blake3_output *out)
+{
+        memcpy (out->cv, chunk->cv, sizeof (out->cv));
+        memcpy (out->block, chunk->block, sizeof (out->block));
+        out->len = chunk->len;
+        out->counter = chunk->counter;
+        out->flags = blake3_chunk_start (chunk) | BLAKE3_CHUNK_END;
+}
+
+
+static void
+blake3_parent_output (const uint32_t left[8], const uint32_t right[8],
+                      struct blake3_output *out)
+{
+        int i = 0;
+
+        for (i = 0; i < 8; i++) {
+                out->block[4 * i]     = left[i];
+                out->block[4 * i + 1] = left[i] >> 8;
+                out->block[4 * i + 2] = left[i] >> 16;
+                out->block[4 * i + 3] = left[i] >> 24;
+                out->block[32 + 4 * i]     = right[i];
+                out->block[32 + 4 * i + 1] = right[i] >> 8;
+                out->block[32 + 4 * i + 2] = right[i] >> 16;
+                out->block[32 + 4 * i + 3] = right[i] >> 24;
+        }
+        memcpy (out->cv, blake3_iv, sizeof (out->cv));
+        out->len = BLAKE3_BLOCK_LEN;
+        out->counter = 0;
+        out->flags = BLAKE3_PARENT;
+}
+
+
+/* push the chaining value of a finished subtree of 2^k chunks, which
+   makes @total (counted in such subtrees) so far. as many subtrees as
+   there are trailing zeros in @total are complete and get merged */
+static void
+blake3_push (blake3_ctx *ctx, const uint32_t cv[8], uint64_t total)
+{
+        struct blake3_output out;
+        uint32_t             merged[8];
+
+        memcpy (merged, cv, sizeof (merged));
+
+        while ((total & 1) == 0) {
+                ctx->depth--;
+                blake3_parent_output (ctx->stack[ctx->depth], merged, &out);
+                blake3_output_cv (&out, merged);
+                total >>= 1;
+        }
+
+        memcpy (ctx->stack[ctx->depth], merged, sizeof (merged));
+        ctx->depth++;
+}
+
+
+static void
+blake3_begin (blake3_ctx *ctx, uint64_t counter)
+{
+        memset (ctx, 0, sizeof (*ctx));
+        blake3_chunk_init (&ctx->chunk, counter);
+}
+
+
+static void
+blake3_update (blake3_ctx *ctx, const void *data, size_t len)
+{
+        struct blake3_output out;
+        const uint8_t       *p = data;
+        uint32_t             cv[8];
+        size_t               n = 0;
+
+        while (len) {
+                /* a full chunk is only closed once more follows */
+                if (blake3_chunk_bytes (&ctx->chunk) == BLAKE3_CHUNK_LEN) {
+                        blake3_chunk_output (&ctx->chunk, &out);
+                        blake3_output_cv (&out, cv);
+                        blake3_push (ctx, cv, ctx->chunk.counter + 1);
+                        blake3_chunk_init (&ctx->chunk,
+                                           ctx->chunk.counter + 1);
+                }
+
+                n = BLAKE3_CHUNK_LEN - blake3_chunk_bytes (&ctx->chunk);
+                if (n > len)
+                        n = len;
+                blake3_chunk_update (&ctx->chunk, p, n);
+                p += n;
+                len -= n;
+        }
+}
+
+
+/* fold the stack into the last chunk. the root is only compressed as
+   such when @out asks for it; otherwise @cv gets the chaining value of
+   the whole subtree */
+static void
+blake3_finish (blake3_ctx *ctx, uint8_t *out, uint32_t cv[8])
+{
+        struct blake3_output node;
+        uint32_t             s[16];
+        uint32_t             right[8];
+        int                  i = 0;
+
+        blake3_chunk_output (&ctx->chunk, &node);
+
+        while (ctx->depth) {
+                ctx->depth--;
+                blake3_output_cv (&node, right);
+                blake3_parent_output (ctx->stack[ctx->depth], right, &node);
+        }
+
+        if (!out) {
+                blake3_output_cv (&node, cv);
+                return;
+        }
+
+        blake3_compress (node.cv, node.block, node.len, 0,
+                         node.flags | BLAKE3_ROOT, s);
+        for (i = 0; i < BLAKE3_OUT_LEN / 4; i++) {
+                out[4 * i]     = s[i];
+                out[4 * i + 1] = s[i] >> 8;
+                out[4 * i + 2] = s[i] >> 16;
+                out[4 * i + 3] = s[i] >> 24;
+        }
+}
+
+
+static void
+blake3_result (blake3_ctx *ctx, uint8_t *out)
+{
+        blake3_finish (ctx, out, NULL);
+}
+
+
+/* files are cut into segments of this many bytes, a power of two of
+   chunks, which threads take one at a time. files up to
+   BLAKE3_PAR_MIN are not worth starting threads for. */
+#define BLAKE3_SEGMENT     (1024 * 1024)
+#define BLAKE3_PAR_MIN     (4 * BLAKE3_SEGMENT)
+#define BLAKE3_THREADS     8
+#define BLAKE3_FD_CHUNK    (64 * 1024)
+
+
+struct blake3_job {
+        int        fd;
+        uint64_t   segments;
+        uint64_t   next;                /* taken atomically */
+        uint32_t (*cvs)[8];
+        int        failed;
+};
+
+
+/* feed @ctx from @off until @end or the end of the file. 0, or -1 with
+   errno set; *@got tells how far it got */
+static int
+blake3_read (blake3_ctx *ctx, int fd, off_t off, off_t end, uint8_t *buf,
+             off_t *got)
+{
+        ssize_t n = 0;
+        size_t  want = 0;
+
+        while (end < 0 || off < end) {
+                want = BLAKE3_FD_CHUNK;
+                if (end >= 0 && (off_t) want > end - off)
+                        want = end - off;
+                n = pread (fd, buf, want, off);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        return -1;
+                if (n == 0)
+                        break;
+                blake3_update (ctx, buf, n);
+                off += n;
+        }
+
+        *got = off;
+        return 0;
+}
+
+
+static void *
+blake3_worker (void *data)
+{
+        struct blake3_job *job = data;
+        blake3_ctx         ctx;
+        uint64_t           seg = 0;
+        uint8_t           *buf = NULL;
+        off_t              off = 0;
+        off_t              got = 0;
+
+        buf = malloc (BLAKE3_FD_CHUNK);
+        if (!buf) {
+                __atomic_store_n (&job->failed, 1, __ATOMIC_RELAXED);
+                return NULL;
+        }
+
+        while ((seg = __atomic_fetch_add (&job->next, 1, __ATOMIC_RELAXED))
+               < job->segments) {
+                off = seg * BLAKE3_SEGMENT;
+                blake3_begin (&ctx, off / BLAKE3_CHUNK_LEN);
+                if (blake3_read (&ctx, job->fd, off, off + BLAKE3_SEGMENT,
+                                 buf, &got) != 0 ||
+                    got != off + BLAKE3_SEGMENT) {
+                        /* a file that shrank is not hashed half way */
+                        __atomic_store_n (&job->failed, 1, __ATOMIC_RELAXED);
+                        break;
+                }
+                blake3_finish (&ctx, NULL, job->cvs[seg]);
+        }
+
+        free (buf);
+        return NULL;
+}
+
+
+/* hash all but the last segment of a big file on up to BLAKE3_THREADS
+   threads, this one included. the helpers run with every signal blocked
+   so that none of the program's handlers ever runs on them. */
+static int
+blake3_segments (struct blake3_job *job)
+{
+        pthread_t      threads[BLAKE3_THREADS - 1];
+        sigset_t       all;
+        sigset_t       old;
+        long           cpus = 0;
+        int            started = 0;
+        int            i = 0;
+
+        cpus = sysconf (_SC_NPROCESSORS_ONLN);
+        if (cpus > BLAKE3_THREADS)
+                cpus = BLAKE3_THREADS;
+        if ((uint64_t) cpus > job->segments)
+                cpus = job->segments;
+
+        sigfillset (&all);
+        pthread_sigmask (SIG_SETMASK, &all, &old);
+        for (i = 0; i < cpus - 1; i++) {
+                if (pthread_create (&threads[started], NULL, blake3_worker,
+                                    job) == 0)
+                        started++;
+        }
+        pthread_sigmask (SIG_SETMASK, &old, NULL);
+
+        blake3_worker (job);
+
+        for (i = 0; i < started; i++)
+                pthread_join (threads[i], NULL);
+
+        return job->failed ? -1 : 0;
+}
+
+
+/* blake3 of all of @fd from offset 0, read and reported like
+   libevil_md5sum_fd does */
+static int
+blake3_fd (int fd, uint8_t *out)
+{
+        struct blake3_job job = {0, };
+        blake3_ctx        ctx;
+        struct stat       stbuf;
+        uint8_t          *buf = NULL;
+        uint64_t          seg = 0;
+        off_t             got = 0;
+        int               ret = -1;
+        int               err = 0;
+
+        buf = malloc (BLAKE3_FD_CHUNK);
+        if (!buf)
+                return -1;
+
+        posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        blake3_begin (&ctx, 0);
+
+        /* the last segment stays with ctx: it holds the root */
+        if (fstat (fd, &stbuf) == 0 && S_ISREG (stbuf.st_mode) &&
+            stbuf.st_size >= BLAKE3_PAR_MIN) {
+                job.fd = fd;
+                job.segments = (stbuf.st_size - 1) / BLAKE3_SEGMENT;
+                job.cvs = malloc (job.segments * sizeof (*job.cvs));
+                if (!job.cvs)
+                        job.segments = 0;
+        }
+
+        if (job.segments) {
+                if (blake3_segments (&job) != 0) {
+                        errno = EIO;
+                        goto out;
+                }
+                for (seg = 0; seg < job.segments; seg++)
+                        blake3_push (&ctx, job.cvs[seg], seg + 1);
+                blake3_chunk_init (&ctx.chunk, job.segments *
+                                   (BLAKE3_SEGMENT / BLAKE3_CHUNK_LEN));
+        }
+
+        if (blake3_read (&ctx, fd, job.segments * BLAKE3_SEGMENT, -1, buf,
+                         &got) != 0)
+                goto out;
+        if (job.segments && got == (off_t) (job.segments * BLAKE3_SEGMENT)) {
+                errno = EIO;
+                goto out;
+        }
+
+        blake3_result (&ctx, out);
+        ret = 0;
+out:
+        err = errno;
+        free (job.cvs);
+        free (buf);
+        errno = err;
+
+        return ret;
+}
@@ -49,6 +49,8 @@ main (int argc, char *argv[])
                 "/lic/pubring.gpg",
                 "/lic/license.req",
                 "/lic/license.asc",
+                "/lic/.sigcache",
+                "/lic/.deadline",
                 "/lic",
                 "/lib/libevil32.so",
                 "/lib64/libevil64.so",
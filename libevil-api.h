@@ -0,0 +1,28 @@
+#ifndef _LIBEVIL_API_H
+#define _LIBEVIL_API_H
+
+#include <time.h>
+
+/* libevil.a, for programs which link the checks and the deadline
+   watcher in, instead of having libevil.so preloaded into them.
+
+   libevil_init() must be called once before anything else. it prepares
+   the checks and starts the deadline watcher, which exits the process
+   once the licence runs out, just like in a preloaded licensed program.
+   further calls do nothing.
+
+   the checks return 1 when the operation would be refused, 0 otherwise.
+*/
+
+void   libevil_init (void);
+
+time_t libevil_deadline (void);
+
+int    libevil_is_protected (int dirfd, const char *path, int follow);
+
+int    libevil_is_protected_fd (int fd);
+
+int    libevil_refuses_rename (int olddirfd, const char *oldpath,
+                               int newdirfd, const char *newpath);
+
+#endif /* _LIBEVIL_API_H */
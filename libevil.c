@@ -30,12 +30,37 @@
 #include <fcntl.h>
 #include <ftw.h>
 #include <glob.h>
+#include <fnmatch.h>
+#include <limits.h>
 #include <ctype.h>
+#include <sched.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <sys/wait.h>
 #include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <poll.h>
+#ifdef HAVE_INOTIFY_INIT1
+#include <sys/inotify.h>
+#endif
+#ifdef HAVE_TIMERFD_CREATE
+#include <sys/timerfd.h>
+#endif
 
 
 #include "libevil.h"
+#ifdef LE_STATIC
+#include "libevil-api.h"
+#endif
 #include "md5.c"
+#include "sha.c"
+#include "blake3.c"
+#ifdef LE_PGPVERIFY
+#include "pgp.c"
+#endif
 
 
 static const char *protpatterns[] =  {
@@ -44,6 +69,8 @@ static const char *protpatterns[] =  {
         LICDIR,
         LICDIR "/gpgv",
         LICDIR "/pubring.gpg",
+        SIGCACHE_FILE,
+        DEADLINE_FILE,
         "/etc",
         "/etc/ld.*.preload",
         "/lib*",
@@ -52,11 +79,30 @@ static const char *protpatterns[] =  {
 };
 
 
+/* why these are checked here and not handed to Landlock:
+
+   - Landlock only grants. an access right handled by a ruleset is denied
+     everywhere it is not granted, and grants on a directory extend to
+     everything beneath it. "/etc" and "/.epoch" must not be removed or
+     renamed while their siblings in "/" may be, and /etc/passwd must stay
+     writable while "/etc" itself may not be renamed. REMOVE_* and REFER
+     are rights on the parent directory, so neither can be expressed.
+   - chmod, chown and utimes are not covered by any access right.
+   - a domain can never be left again, but a process only becomes
+     licensed later, from epoll_create, and licensed programs must not
+     be restricted at all.
+   - a constructor in ld.so.preload still never runs in a static binary,
+     so Landlock would not close that gap either.
+*/
+
+
+#ifndef LE_STATIC
 static const char *licensed_symbols[] = {
         "iobuf_get",
         "gf_log_init",
         NULL,
 };
+#endif
 
 
 static int le_debug = 0;
@@ -124,1007 +170,4359 @@ globerr (const char *epath, int eerrno)
 }
 
 
-struct permit_entry {
-        struct permit_entry *next;
-        unsigned char        md5sum[16];
-        char                *path;
+/* permit.asc lines "ALGO:DIGEST PATH", each letting a file with that
+   digest be renamed over the protected PATH. a bare 32 digit DIGEST is
+   an md5sum, the format before digests were tagged. as soon as a file
+   has tagged lines of a stronger digest, its md5 lines are only there
+   for older shims and are not trusted. open-addressed by the digest,
+   which is uniform enough to index by its first bytes; path == NULL
+   marks an empty slot. the identity PATH had when the table was built
+   matches a rename without looking PATH up again, as long as the inode
+   has kept its ctime too: the number alone may have gone to another
+   file since, or PATH been moved elsewhere. the table, its slots
+   and the paths are one allocation, rebuilt from scratch when
+   permit.asc changes and published like protect.set.
+*/
+enum {
+        PERMIT_MD5,
+        PERMIT_SHA256,
+        PERMIT_BLAKE3,
+        PERMIT_ALGOS,
 };
 
+#define PERMIT_DIGEST_MAX 32
 
-static struct {
-        pthread_rwlock_t     rwlock;
-        glob_t               protglob;
-        struct stat         *stats;
-        int                  permitcnt;
-        struct permit_entry *permits;
-        char                 macid[64];
-        pthread_t            bigbro;
-} protect;
 
+static const struct {
+        const char          *tag;
+        size_t               len;       /* digest bytes */
+} permit_algos[PERMIT_ALGOS] = {
+        [PERMIT_MD5]    = { "md5",    16 },
+        [PERMIT_SHA256] = { "sha256", 32 },
+        [PERMIT_BLAKE3] = { "blake3", 32 },
+};
 
-static int is_signed_file (const char *filename);
 
-static void
-__rehash_glob (void)
-{
-        int          ret = 0;
-        int          i = 0;
-        int          globflags = GLOB_BRACE;
-        const char  *pattern = NULL;
-        char       **files = NULL;
-        struct stat *stats = NULL;
+struct permit_entry {
+        unsigned char        digest[PERMIT_DIGEST_MAX];
+        int                  algo;
+        const char          *path;
+        dev_t                dev;
+        ino_t                ino;       /* 0 if PATH is to be looked up */
+        struct timespec      ctime;
+};
 
 
-        if (protect.protglob.gl_pathc) {
-                globfree (&protect.protglob);
-                protect.protglob.gl_pathc = 0;
-                if (protect.stats)
-                        free (protect.stats);
-                protect.stats = NULL;
-        }
+struct permtab {
+        unsigned int         mask;
+        unsigned int         count;
+        unsigned int         algos;     /* 1 << PERMIT_* in the table */
+        struct stat          file;      /* permit.asc as it was read */
+        struct permit_entry  ents[];
+};
 
-        for (i = 0; (pattern = protpatterns[i]); i++) {
-                ret = glob (pattern, globflags, globerr, &protect.protglob);
 
-                if (ret && ret != GLOB_NOMATCH) {
-                        globfree (&protect.protglob);
-                        protect.protglob.gl_pathc = 0;
-                        return;
-                }
+/* digests of files that were checked against the permits, so that a
+   rename retried on the same staged file, or of another link to it,
+   costs an fstat instead of reading the file again. an entry holds as
+   long as the inode's size, mtime and ctime do: nothing rewrites a
+   file without moving its ctime, and nothing can set it back.
+*/
+#define DIGCACHE_ENTS 64
 
-                globflags |= GLOB_APPEND;
-        }
 
-        files = protect.protglob.gl_pathv;
+struct digcache_ent {
+        dev_t                dev;
+        ino_t                ino;       /* 0 if the slot is empty */
+        off_t                size;
+        struct timespec      mtime;
+        struct timespec      ctime;
+        int                  algo;
+        unsigned char        digest[PERMIT_DIGEST_MAX];
+};
 
-        stats = calloc (protect.protglob.gl_pathc, sizeof (*stats));
-        if (!stats) {
-                globfree (&protect.protglob);
-                protect.protglob.gl_pathc = 0;
-                return;
-        }
 
-        for (i = 0; i < protect.protglob.gl_pathc; i++) {
-                ret = lstat (files[i], &stats[i]);
-                if (ret == 0) {
-#if 0
-                        dbg ("%s: %lld/%lld\n", files[i],
-                             (long long) (stats[i].st_ino),
-                             (long long) (stats[i].st_dev));
+static struct {
+        le_lock_t            lock;
+        int                  ready;
+        unsigned long        hits;
+        unsigned long        misses;
+        struct digcache_ent  ents[DIGCACHE_ENTS];
+} digcache;
+
+
+/* files created by this process, digested as they are written, so that
+   renaming one over a protected path finds its digest in digcache and
+   reads nothing back. a slot follows one fd from the open that created
+   the file to its close, where the digests are stored if every byte of
+   the file went through the traps in order: a write that lands anywhere
+   but at the end of what was digested, a seek back, a shared mapping
+   or a fork drops the slot's digests for good. a write the traps do not
+   see (stdio, writev, copy_file_range, another process) is caught at
+   close if it changed the size. one that rewrote bytes in place is not,
+   which is why this is a configure option: whatever can write behind
+   the traps can rename behind them as well.
+*/
+#if defined (LE_WRITEDIGEST) && defined (LE_STATIC)
+/* nothing sees the writes of a program linking libevil.a */
+#undef LE_WRITEDIGEST
 #endif
-                } else {
-                        dbg ("%s: %s\n", files[i], strerror (errno));
-                }
-        }
 
-        protect.stats = stats;
+#ifdef LE_WRITEDIGEST
+#define WDIGEST_ENTS 16
+
+
+struct wdigest {
+        pthread_mutex_t      lock;      /* held across the write folded in */
+        int                  fd;        /* -1 if free, -2 while taken */
+        int                  live;      /* NO once a write went unseen */
+        dev_t                dev;
+        ino_t                ino;
+        off_t                pos;       /* the fd's offset, as write() moves it */
+        off_t                len;       /* bytes digested, from offset 0 */
+        unsigned int         algos;     /* 1 << PERMIT_* being kept */
+        md_context           md5;
+        sha_ctx              sha256;
+        blake3_ctx           blake3;
+};
 
-        return;
-}
 
+static struct {
+        int                  ready;
+        int                  active;    /* slots in use */
+        unsigned long        kept;
+        unsigned long        dropped;
+        struct wdigest       ents[WDIGEST_ENTS];
+} wdigests;
+#endif
 
-static void
-rehash_glob (void)
-{
-        pthread_rwlock_wrlock (&protect.rwlock);
-        {
-                __rehash_glob ();
-        }
-        pthread_rwlock_unlock (&protect.rwlock);
-}
 
+#define PROTDEV_MAX 16
 
-static void
-prepare_glob (void)
-{
-        pthread_rwlock_init (&protect.rwlock, NULL);
-        rehash_glob ();
-}
 
+/* open-addressed set of protected (dev, ino) pairs. ino == 0 marks an
+   empty slot. rebuilt from scratch by __rehash_glob, never updated in place.
+*/
+struct protent {
+        dev_t                dev;
+        ino_t                ino;
+};
 
-static int
-__is_protected_atpath (int dirfd, const char *path, int follow)
-{
-        int           i = 0;
-        int           pathc = 0;
-        struct stat  *stats = NULL;
-        struct stat   mystat = {0, };
-        int           ret = 0;
-        int           flags = AT_SYMLINK_NOFOLLOW;
 
-        pathc = protect.protglob.gl_pathc;
-        stats = protect.stats;
+struct protset {
+        unsigned int         mask;
+        unsigned int         count;
+#ifdef LE_PARENTFILTER
+        struct protset      *parents;   /* directories holding the entries */
+#endif
+#ifdef LE_DEVFILTER
+        dev_t               *foreign;   /* remote devices, see __rehash_mounts */
+        unsigned int         foreigncnt;
+#endif
+#ifdef LE_WRITEDIGEST
+        dev_t                devs[PROTDEV_MAX]; /* devices holding entries */
+        int                  devcnt;    /* -1 if there were more */
+#endif
+        struct protent       ents[] __attribute__((aligned (16)));
+};
+
 
-        if (follow)
-                flags = 0;
+static struct {
+        pthread_rwlock_t     rwlock;    /* only for unregistered readers */
+        struct protset      *set;       /* published snapshot */
+        unsigned int         gen;       /* bumped after each publication */
+        struct permtab      *permits;   /* published table */
+        char                 macid[64];
+        pthread_t            bigbro;
+} protect = {
+        .rwlock = PTHREAD_RWLOCK_INITIALIZER,
+};
 
-        ret = fstatat (dirfd, path, &mystat, flags);
-        if (ret)
-                return NO;
 
-        for (i = 0; i < pathc; i++) {
-                if (stats[i].st_ino == mystat.st_ino
-                    && stats[i].st_dev == mystat.st_dev)
-                        return YES;
-        }
+/* readers of protect.set announce themselves by storing the epoch they
+   started in to their own, thread-local, cache line. a writer retiring
+   a snapshot bumps the epoch and waits until no reader is still inside
+   an older one. readers never write to memory shared with other threads.
+*/
+struct le_reader {
+        struct le_reader    *next;
+        unsigned long        epoch;     /* 0 when not reading */
+        int                  nest;
+        int                  state;     /* 0 new, 1 registered, -1 fallback */
+} __attribute__((aligned (64)));
 
-        return NO;
-}
 
+static __thread struct le_reader le_self;
 
-static int
-__is_protected_atfile (int dirfd, const char *path)
-{
-        return __is_protected_atpath (dirfd, path, 1);
-}
 
+static struct {
+        le_lock_t            lock;
+        struct le_reader    *list;
+        unsigned long        epoch;
+        pthread_key_t        key;
+        int                  ready;
+} readers = {
+        .epoch = 1,
+};
 
-static int
-is_protected_atfile (int dirfd, const char *path)
+
+static int is_signed_fd (int fd);
+#if defined (LE_SIGCACHE) || defined (LE_SHAREDDEADLINE)
+static int le_openat (int dirfd, const char *path, int flags, mode_t mode);
+#endif
+
+
+static unsigned int
+protset_hash (dev_t dev, ino_t ino)
 {
-        int   ret = 0;
+        uint64_t h = 0;
 
-        pthread_rwlock_rdlock (&protect.rwlock);
-        {
-                ret = __is_protected_atfile (dirfd, path);
-        }
-        pthread_rwlock_unlock (&protect.rwlock);
+        h = ((uint64_t) ino) ^ ((uint64_t) dev << 29) ^ ((uint64_t) dev >> 35);
+        h *= 0x9E3779B97F4A7C15ULL;
 
-        return ret;
+        return (unsigned int) (h >> 32);
 }
 
 
-static int
-__is_protected_atentry (int dirfd, const char *path)
+static struct protset *
+protset_new (size_t count)
 {
-        return __is_protected_atpath (dirfd, path, 0);
+        struct protset *set = NULL;
+        size_t          slots = 8;
+
+        /* keep the load factor under 2/3 so probes stay short */
+        while (slots < count + count / 2 + 1)
+                slots <<= 1;
+
+        if (posix_memalign ((void **) &set, 64,
+                            sizeof (*set) + slots * sizeof (set->ents[0])))
+                return NULL;
+
+        memset (set, 0, sizeof (*set) + slots * sizeof (set->ents[0]));
+        set->mask = slots - 1;
+
+        return set;
 }
 
 
-static int
-is_protected_atentry (int dirfd, const char *path)
+static void
+protset_add (struct protset *set, dev_t dev, ino_t ino)
 {
-        int   ret = 0;
+        unsigned int i = 0;
 
-        pthread_rwlock_rdlock (&protect.rwlock);
-        {
-                ret = __is_protected_atentry (dirfd, path);
+        if (!ino)
+                return;
+
+        for (i = protset_hash (dev, ino) & set->mask; set->ents[i].ino;
+             i = (i + 1) & set->mask) {
+                if (set->ents[i].ino == ino && set->ents[i].dev == dev)
+                        return;
         }
-        pthread_rwlock_unlock (&protect.rwlock);
 
-        return ret;
+        set->ents[i].dev = dev;
+        set->ents[i].ino = ino;
+        set->count++;
 }
 
 
 static int
-is_protected_file (const char *path)
+protset_has (const struct protset *set, dev_t dev, ino_t ino)
 {
-        int   ret = 0;
+        unsigned int i = 0;
 
-        pthread_rwlock_rdlock (&protect.rwlock);
-        {
-                ret = __is_protected_atfile (AT_FDCWD, path);
+        if (!set)
+                return NO;
+
+        for (i = protset_hash (dev, ino) & set->mask; set->ents[i].ino;
+             i = (i + 1) & set->mask) {
+                if (set->ents[i].ino == ino && set->ents[i].dev == dev)
+                        return YES;
         }
-        pthread_rwlock_unlock (&protect.rwlock);
 
-        return ret;
+        return NO;
 }
 
 
-static int
-is_protected_entry (const char *path)
+static void
+protset_free (struct protset *set)
 {
-        int   ret = 0;
-
-        pthread_rwlock_rdlock (&protect.rwlock);
-        {
-                ret = __is_protected_atentry (AT_FDCWD, path);
-        }
-        pthread_rwlock_unlock (&protect.rwlock);
+        if (!set)
+                return;
 
-        return ret;
+#ifdef LE_PARENTFILTER
+        free (set->parents);
+#endif
+#ifdef LE_DEVFILTER
+        free (set->foreign);
+#endif
+        free (set);
 }
 
 
-static int
-__is_protected_fd (int fd)
+#ifdef LE_PARENTFILTER
+static void
+protset_add_parent (struct protset *parents, const char *path)
 {
-        int           i = 0;
-        int           pathc = 0;
-        struct stat  *stats = NULL;
-        struct stat   mystat = {0, };
-        int           ret = 0;
+        char         dir[PATH_MAX];
+        char        *slash = NULL;
+        struct stat  stbuf = {0, };
 
-        pathc = protect.protglob.gl_pathc;
-        stats = protect.stats;
+        if (strlen (path) >= sizeof (dir))
+                return;
 
-        ret = fstat (fd, &mystat);
-        if (ret)
-                return NO;
+        strcpy (dir, path);
 
-        for (i = 0; i < pathc; i++) {
-                if (stats[i].st_ino == mystat.st_ino
-                    && stats[i].st_dev == mystat.st_dev)
-                        return YES;
+        slash = strrchr (dir, '/');
+        if (!slash)
+                return;
+
+        if (slash == dir)
+                slash[1] = '\0';
+        else
+                slash[0] = '\0';
+
+        /* the directory a dirfd would actually refer to */
+        if (stat (dir, &stbuf) != 0) {
+                dbg ("%s: %s\n", dir, strerror (errno));
+                return;
         }
 
-        return NO;
+        protset_add (parents, stbuf.st_dev, stbuf.st_ino);
 }
+#endif
+
+
+/* stat for the checks, which only need the identity and type of an
+   entry. those never change for a given inode, so statx() may answer
+   from cached attributes instead of asking a network filesystem again.
+   ctime has to be current and is fetched the usual way.
+*/
+#ifndef STATX_CTIME
+#define STATX_CTIME     0
+#endif
 
 
 static int
-is_protected_fd (int fd)
+le_statat (int dirfd, const char *path, int flags, unsigned int mask,
+           struct stat *stbuf)
 {
-        int   ret = 0;
+#ifdef HAVE_STATX
+        static int   nostatx = 0;
+        struct statx stx;
+        int          ret = 0;
 
-        pthread_rwlock_rdlock (&protect.rwlock);
-        {
-                ret = __is_protected_fd (fd);
-        }
-        pthread_rwlock_unlock (&protect.rwlock);
+        if (!nostatx) {
+                if (!(mask & STATX_CTIME))
+                        flags |= AT_STATX_DONT_SYNC;
 
-        return ret;
+                ret = statx (dirfd, path, flags,
+                             mask | STATX_TYPE | STATX_INO, &stx);
+                if (ret == 0) {
+                        memset (stbuf, 0, sizeof (*stbuf));
+                        stbuf->st_dev = makedev (stx.stx_dev_major,
+                                                 stx.stx_dev_minor);
+                        stbuf->st_ino = stx.stx_ino;
+                        stbuf->st_mode = stx.stx_mode;
+                        stbuf->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+                        stbuf->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+                        return 0;
+                }
+
+                if (errno != ENOSYS)
+                        return ret;
+
+                nostatx = 1;
+                flags &= ~AT_STATX_DONT_SYNC;
+        }
+#endif
+        return fstatat (dirfd, path, stbuf, flags);
 }
 
 
-static time_t
-get_default_deadline (void)
+#ifdef LE_DEVFILTER
+/* devices of network and FUSE filesystems, where every stat may be a
+   round trip. a directory on one of these holds no protected entry, as
+   long as none of them lives there and nothing is mounted beneath it.
+   the mount table is read once, so a mount made later beneath a remote
+   filesystem goes unnoticed until the next exec.
+*/
+static const char *remotefstypes[] = {
+        "nfs", "nfs4", "cifs", "smb3", "smbfs", "ceph", "9p", "afs",
+        "glusterfs", "lustre", "ncpfs", "coda", "virtiofs",
+        NULL,
+};
+
+
+struct mountent {
+        int                  id;
+        int                  parent;
+        dev_t                dev;
+        int                  remote;
+};
+
+
+static int
+is_remote_fstype (const char *fstype)
 {
-        struct stat epoch_stat = {0, };
-        int         ret = 0;
-        time_t      epoch = 0;
+        int i = 0;
 
-        ret = lstat (EPOCH_FILE, &epoch_stat);
-        if (ret != 0)
-                return 0;
+        if (strncmp (fstype, "fuse", 4) == 0)
+                return YES;
 
-        epoch = epoch_stat.st_ctime;
-        if (epoch_stat.st_mtime < epoch)
-                epoch = epoch_stat.st_mtime;
-        if (epoch_stat.st_atime < epoch)
-                epoch = epoch_stat.st_atime;
+        for (i = 0; remotefstypes[i]; i++) {
+                if (strcmp (fstype, remotefstypes[i]) == 0)
+                        return YES;
+        }
 
-        return (epoch + default_timeout);
+        return NO;
 }
 
 
-static time_t
-license_parse (FILE *fp)
-{
-        char   line[1024];
-        char  *l = NULL;
-        char  *saveptr = NULL;;
-        char  *macid = NULL;
-        char  *timestamp = NULL;
-        char  *end = NULL;
-        time_t final_ts = 0;
-        time_t ts = 0;
-        char   timebuf[64];
+static void
+__rehash_mounts (struct protset *set, const dev_t *protdevs, int protdevcnt)
+{
+        FILE            *fp = NULL;
+        char            *line = NULL;
+        size_t           linesz = 0;
+        char            *sep = NULL;
+        char             fstype[64];
+        unsigned int     major = 0;
+        unsigned int     minor = 0;
+        struct mountent *mounts = NULL;
+        struct mountent *tmp = NULL;
+        int              mountcnt = 0;
+        int              i = 0;
+        int              j = 0;
+
+        fp = fopen ("/proc/self/mountinfo", "re");
+        if (!fp)
+                return;
 
+        while (getline (&line, &linesz, fp) > 0) {
+                tmp = realloc (mounts, (mountcnt + 1) * sizeof (*mounts));
+                if (!tmp)
+                        goto out;
+                mounts = tmp;
 
-        while ((l = fgets (line, 1024, fp))) {
-                macid = strtok_r (line, " \r\n\t", &saveptr);
-                if (!macid)
+                if (sscanf (line, "%d %d %u:%u", &mounts[mountcnt].id,
+                            &mounts[mountcnt].parent, &major, &minor) != 4)
                         continue;
 
-                if (strcmp (macid, protect.macid) != 0) {
-                        macid = NULL;
+                sep = strstr (line, " - ");
+                if (!sep || sscanf (sep + 3, "%63s", fstype) != 1)
                         continue;
-                }
 
-                dbg ("found entry macid=%s\n", macid);
+                mounts[mountcnt].dev = makedev (major, minor);
+                mounts[mountcnt].remote = is_remote_fstype (fstype);
+                mountcnt++;
+        }
+
+        set->foreign = calloc (mountcnt + 1, sizeof (dev_t));
+        if (!set->foreign)
+                goto out;
 
-                timestamp = strtok_r (NULL, " \r\n\t", &saveptr);
-                if (!timestamp) {
-                        macid = NULL;
+        for (i = 0; i < mountcnt; i++) {
+                if (!mounts[i].remote)
                         continue;
+
+                for (j = 0; j < protdevcnt; j++) {
+                        if (protdevs[j] == mounts[i].dev)
+                                mounts[i].remote = 0;
                 }
+        }
 
-                dbg ("found timestamp %s for macid=%s\n", timestamp, macid);
-                ts = strtoul (timestamp, &end, 10);
-                if (*end != '\0') {
-                        macid = NULL;
-                        timestamp = NULL;
-                        continue;
+        /* a device mounted anywhere with something beneath it is out */
+        for (i = 0; i < mountcnt; i++) {
+                for (j = 0; j < mountcnt; j++) {
+                        if (mounts[j].parent == mounts[i].id &&
+                            mounts[j].id != mounts[i].id)
+                                break;
                 }
+                if (j == mountcnt)
+                        continue;
 
-                if (ts > final_ts)
-                        final_ts = ts;
+                for (j = 0; j < mountcnt; j++) {
+                        if (mounts[j].dev == mounts[i].dev)
+                                mounts[j].remote = 0;
+                }
         }
 
-        dbg ("final timestamp = %llu (%s)\n", (unsigned long long) final_ts,
-             strip_n (ctime_r (&final_ts, timebuf)));
+        for (i = 0; i < mountcnt; i++) {
+                if (!mounts[i].remote)
+                        continue;
 
-        return final_ts;
+                for (j = 0; j < set->foreigncnt; j++) {
+                        if (set->foreign[j] == mounts[i].dev)
+                                break;
+                }
+
+                if (j == set->foreigncnt)
+                        set->foreign[set->foreigncnt++] = mounts[i].dev;
+        }
+
+        dbg ("%u remote devices\n", set->foreigncnt);
+out:
+        free (mounts);
+        free (line);
+        fclose (fp);
 }
+#endif
 
 
-static time_t
-get_license_deadline (void)
+static struct protset *
+__rehash_glob (void)
 {
-        int                  ret = 0;
-        struct stat          lic_stat = {0, };
-        static struct stat   lic_stat_prev = {0, };
-        static time_t        lic_deadline = 0;
-        FILE                *lfp = NULL;
+        int             ret = 0;
+        int             i = 0;
+        int             globflags = GLOB_BRACE;
+        const char     *pattern = NULL;
+        glob_t          protglob = {0, };
+        struct stat     stbuf = {0, };
+        struct protset *set = NULL;
+#if defined (LE_DEVFILTER) || defined (LE_WRITEDIGEST)
+        dev_t           protdevs[PROTDEV_MAX];
+        int             protdevcnt = 0;
+        int             j = 0;
+#endif
 
-        /* be symlink friendly */
-        ret = stat (LICFILE, &lic_stat);
-        if (ret)
-                return 0;
 
-        if (lic_stat.st_mtime == lic_stat_prev.st_mtime &&
-            lic_stat.st_ctime == lic_stat_prev.st_ctime &&
-            lic_stat.st_ino   == lic_stat_prev.st_ino &&
-            lic_stat.st_dev   == lic_stat_prev.st_dev) {
-                /* nothing changed */
-                return lic_deadline;
-        }
+        for (i = 0; (pattern = protpatterns[i]); i++) {
+                ret = glob (pattern, globflags, globerr, &protglob);
 
-        lfp = fopen (LICFILE, "r");
-        if (!lfp)
-                return 0;
+                if (ret && ret != GLOB_NOMATCH) {
+                        globfree (&protglob);
+                        return NULL;
+                }
 
-        ret = is_signed_file (LICFILE);
-        if (ret != YES) {
-                fclose (lfp);
-                return 0;
+                globflags |= GLOB_APPEND;
         }
 
-        lic_deadline = license_parse (lfp);
-        lic_stat_prev = lic_stat;
-
-        fclose (lfp);
+        set = protset_new (protglob.gl_pathc);
+        if (!set) {
+                globfree (&protglob);
+                return NULL;
+        }
 
-        return lic_deadline;
-}
+#ifdef LE_PARENTFILTER
+        set->parents = protset_new (protglob.gl_pathc);
+        if (!set->parents) {
+                free (set);
+                globfree (&protglob);
+                return NULL;
+        }
 
+        for (i = 0; i < protglob.gl_pathc; i++)
+                protset_add_parent (set->parents, protglob.gl_pathv[i]);
+#endif
 
-static time_t
-get_latest_deadline (void)
-{
-        time_t              def_deadline = 0;
-        time_t              lic_deadline = 0;
-        time_t              deadline = 0;
-        char                timebuf1[64];
-        char                timebuf2[64];
+        for (i = 0; i < protglob.gl_pathc; i++) {
+                ret = lstat (protglob.gl_pathv[i], &stbuf);
+                if (ret != 0) {
+                        dbg ("%s: %s\n", protglob.gl_pathv[i], strerror (errno));
+                        continue;
+                }
 
-        def_deadline = get_default_deadline ();
-        lic_deadline = get_license_deadline ();
+                protset_add (set, stbuf.st_dev, stbuf.st_ino);
 
-        dbg ("def_deadline = %s lic_deadline=%s\n",
-             strip_n (ctime_r (&def_deadline, timebuf1)),
-             strip_n (ctime_r (&lic_deadline, timebuf2)));
+#if defined (LE_DEVFILTER) || defined (LE_WRITEDIGEST)
+                for (j = 0; j < protdevcnt; j++) {
+                        if (protdevs[j] == stbuf.st_dev)
+                                break;
+                }
 
-        deadline = MAX (def_deadline, lic_deadline);
+                if (j == protdevcnt && protdevcnt < PROTDEV_MAX)
+                        protdevs[protdevcnt++] = stbuf.st_dev;
+                else if (j == protdevcnt)
+                        protdevcnt = -1;
+#endif
+        }
 
-        return deadline;
+#ifdef LE_DEVFILTER
+        /* too many devices to tell: trust none of them to be foreign */
+        if (protdevcnt >= 0)
+                __rehash_mounts (set, protdevs, protdevcnt);
+#endif
+#ifdef LE_WRITEDIGEST
+        set->devcnt = protdevcnt;
+        if (protdevcnt > 0)
+                memcpy (set->devs, protdevs, protdevcnt * sizeof (dev_t));
+#endif
+
+        dbg ("protecting %u entries in %u slots\n", set->count, set->mask + 1);
+
+        globfree (&protglob);
+
+        return set;
 }
 
 
-static void *
-bigbro_is_watching (void *data)
+static void
+reader_unregister (void *data)
 {
-        int     can_live = YES;
-        time_t  deadline = -1;
-        time_t  new_deadline = 0;
-        time_t  now = 0;
-        char    timebuf1[64];
-        char    timebuf2[64];
+        struct le_reader  *self = data;
+        struct le_reader **r = NULL;
 
-        for (can_live = YES; can_live == YES; sleep (10)) {
-                new_deadline = get_latest_deadline ();
-                if (deadline != new_deadline) {
-                        dbg ("updated deadline: %s\n",
-                             strip_n (ctime_r (&new_deadline, timebuf1)));
+        LOCK (&readers.lock);
+        {
+                for (r = &readers.list; *r; r = &(*r)->next) {
+                        if (*r == self) {
+                                *r = self->next;
+                                break;
+                        }
                 }
-                deadline = new_deadline;
-                now = time (NULL);
+        }
+        UNLOCK (&readers.lock);
 
-                if (deadline < now) {
-                        err ("deadline was: %s, now is: %s\n",
-                             strip_n (ctime_r (&deadline, timebuf1)),
-                             strip_n (ctime_r (&now, timebuf2)));
-                        /* >:) */
-                        break;
-                }
+        /* later destructors of this thread may still trap */
+        self->state = -1;
+}
+
+
+static struct le_reader *
+reader_register (void)
+{
+        struct le_reader *self = &le_self;
+
+        if (self->state)
+                return (self->state > 0) ? self : NULL;
+
+        self->state = -1;
+
+        if (!readers.ready)
+                return NULL;
+
+        if (pthread_setspecific (readers.key, self) != 0)
+                return NULL;
+
+        LOCK (&readers.lock);
+        {
+                self->next = readers.list;
+                readers.list = self;
         }
+        UNLOCK (&readers.lock);
 
-        exit (1);
+        self->state = 1;
 
-        return NULL;
+        return self;
 }
 
 
-static void
-bb_child (void)
+static struct le_reader *
+reader_enter (void)
 {
-        int ret = 0;
+        struct le_reader *self = &le_self;
+        unsigned long     epoch = 0;
 
-        ret = pthread_create (&protect.bigbro, NULL, bigbro_is_watching, NULL);
-        if (ret != 0)
-                protect.bigbro = 0;
+        if (self->state <= 0)
+                self = reader_register ();
+
+        if (!self) {
+                pthread_rwlock_rdlock (&protect.rwlock);
+                return NULL;
+        }
+
+        /* a signal handler may trap while we are inside a read */
+        if (self->nest++ == 0) {
+                epoch = __atomic_load_n (&readers.epoch, __ATOMIC_ACQUIRE);
+                __atomic_store_n (&self->epoch, epoch, __ATOMIC_RELAXED);
+                __atomic_thread_fence (__ATOMIC_SEQ_CST);
+        }
+        __atomic_signal_fence (__ATOMIC_SEQ_CST);
+
+        return self;
 }
 
 
 static void
-big_brother_kickoff (void)
+reader_exit (struct le_reader *self)
 {
-        int ret = 0;
-
-        ret = pthread_atfork (NULL, NULL, bb_child);
-        if (ret != 0) {
-                dbg ("failed pthread_atfork (%s)\n", strerror (errno));
+        if (!self) {
+                pthread_rwlock_unlock (&protect.rwlock);
                 return;
         }
 
-        ret = pthread_create (&protect.bigbro, NULL, bigbro_is_watching, NULL);
-        if (ret != 0)
-                protect.bigbro = 0;
+        __atomic_signal_fence (__ATOMIC_SEQ_CST);
+        if (--self->nest == 0)
+                __atomic_store_n (&self->epoch, 0, __ATOMIC_RELEASE);
 }
 
 
-static int  is_licensed = -1;
-
-
-static int
-is_licensed_prog (void)
+static void
+synchronize_readers (void)
 {
-        int         i = 0;
-        const char *symbol = NULL;
+        unsigned long     epoch = 0;
+        unsigned long     seen = 0;
+        struct le_reader *r = NULL;
 
+        epoch = __atomic_add_fetch (&readers.epoch, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence (__ATOMIC_SEQ_CST);
 
-        if (is_licensed == -1) {
-                for (i = 0; (symbol = licensed_symbols[i]); i++) {
-                        if (dlsym (RTLD_NEXT, symbol) != NULL) {
-                                is_licensed = 1;
-                                break;
+        LOCK (&readers.lock);
+        {
+                for (r = readers.list; r; r = r->next) {
+                        for (;;) {
+                                seen = __atomic_load_n (&r->epoch,
+                                                        __ATOMIC_ACQUIRE);
+                                if (seen == 0 || seen >= epoch)
+                                        break;
+                                sched_yield ();
                         }
                 }
+        }
+        UNLOCK (&readers.lock);
+
+        /* and the stragglers which could not register */
+        pthread_rwlock_wrlock (&protect.rwlock);
+        pthread_rwlock_unlock (&protect.rwlock);
+}
+
+
+#ifdef LE_WRITEDIGEST
+/* parent and child share the offset of every fd and either may write
+   through it next, so neither can keep following the writes */
+static void
+wdigests_prepare (void)
+{
+        int i = 0;
+
+        for (i = 0; i < WDIGEST_ENTS; i++)
+                pthread_mutex_lock (&wdigests.ents[i].lock);
+}
+
 
-                if (!symbol)
-                        is_licensed = 0;
+static void
+wdigests_forked (int child)
+{
+        struct wdigest *wd = NULL;
+        int             i = 0;
 
-                if (is_licensed) {
-                        dbg ("found symbol %s -- is a licensed program\n",
-                             symbol);
-                        big_brother_kickoff ();
+        for (i = 0; i < WDIGEST_ENTS; i++) {
+                wd = &wdigests.ents[i];
+                if (wd->fd >= 0 && wd->live) {
+                        wd->live = NO;
+                        wdigests.dropped++;
                 }
+                if (child)
+                        pthread_mutex_init (&wd->lock, NULL);
+                else
+                        pthread_mutex_unlock (&wd->lock);
         }
+}
+#endif
+
 
-        return is_licensed;
+static void
+readers_prepare (void)
+{
+#ifdef LE_WRITEDIGEST
+        wdigests_prepare ();
+#endif
+        LOCK (&readers.lock);
+        LOCK (&digcache.lock);
 }
 
 
 static void
-make_licensed_prog (void)
+readers_parent (void)
+{
+        UNLOCK (&digcache.lock);
+        UNLOCK (&readers.lock);
+#ifdef LE_WRITEDIGEST
+        wdigests_forked (NO);
+#endif
+}
+
+
+static void
+readers_child (void)
+{
+        /* the other threads are gone, along with their reads */
+        LOCK_INIT (&readers.lock);
+        LOCK_INIT (&digcache.lock);
+#ifdef LE_WRITEDIGEST
+        wdigests_forked (YES);
+#endif
+        readers.list = NULL;
+
+        if (le_self.state > 0) {
+                le_self.next = NULL;
+                readers.list = &le_self;
+        }
+}
+
+
+static void
+rehash_glob (void)
 {
-        if (is_licensed == 1)
+        struct protset *set = NULL;
+        struct protset *old = NULL;
+
+        set = __rehash_glob ();
+        if (!set)
                 return;
 
-        is_licensed = 1;
-        big_brother_kickoff ();
+        old = __atomic_exchange_n (&protect.set, set, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch (&protect.gen, 1, __ATOMIC_RELEASE);
+        if (!old)
+                return;
+
+        synchronize_readers ();
+        protset_free (old);
+}
+
+
+static void
+prepare_glob (void)
+{
+#ifdef LE_WRITEDIGEST
+        int i = 0;
+
+        for (i = 0; i < WDIGEST_ENTS; i++) {
+                pthread_mutex_init (&wdigests.ents[i].lock, NULL);
+                wdigests.ents[i].fd = -1;
+        }
+#endif
+        LOCK_INIT (&readers.lock);
+        LOCK_INIT (&digcache.lock);
+
+        if (pthread_key_create (&readers.key, reader_unregister) == 0 &&
+            pthread_atfork (readers_prepare, readers_parent,
+                            readers_child) == 0) {
+                readers.ready = 1;
+                digcache.ready = 1;
+#ifdef LE_WRITEDIGEST
+                wdigests.ready = 1;
+#endif
+        }
+
+        rehash_glob ();
 }
 
 
 static int
-is_signed_file (const char *filename)
+is_protected_ino (dev_t dev, ino_t ino)
 {
-        int  len = 0;
-        int  ret = 0;
-        int  status = 0;
-        char cmdbuf[1024];
+        struct le_reader *self = NULL;
+        int               ret = NO;
 
-        len = snprintf (cmdbuf, 1024, "%s/gpgv --keyring %s/pubring.gpg %s >/dev/null 2>&1",
-                        LICDIR, LICDIR, filename);
+        self = reader_enter ();
+        {
+                ret = protset_has (__atomic_load_n (&protect.set,
+                                                    __ATOMIC_ACQUIRE),
+                                   dev, ino);
+        }
+        reader_exit (self);
 
-        if (len >= 1024) {
-                dbg ("cmd too long (%d)\n", len);
-                return NO;
+        return ret;
+}
+
+
+#ifdef LE_PARENTFILTER
+static int
+is_parent_ino (dev_t dev, ino_t ino)
+{
+        struct le_reader *self = NULL;
+        struct protset   *set = NULL;
+        int               ret = YES;
+
+        self = reader_enter ();
+        {
+                set = __atomic_load_n (&protect.set, __ATOMIC_ACQUIRE);
+                if (set)
+                        ret = protset_has (set->parents, dev, ino);
         }
+        reader_exit (self);
 
-        status = system (cmdbuf);
+        return ret;
+}
+#endif
 
-        ret = WEXITSTATUS(status);
 
-        dbg ("%s: %d\n", cmdbuf, status);
+#ifdef LE_DEVFILTER
+static int
+is_foreign_dev (dev_t dev)
+{
+        struct le_reader *self = NULL;
+        struct protset   *set = NULL;
+        unsigned int      i = 0;
+        int               ret = NO;
 
-        if (ret == 0)
-                return YES;
+        self = reader_enter ();
+        {
+                set = __atomic_load_n (&protect.set, __ATOMIC_ACQUIRE);
+                for (i = 0; set && i < set->foreigncnt; i++) {
+                        if (set->foreign[i] == dev) {
+                                ret = YES;
+                                break;
+                        }
+                }
+        }
+        reader_exit (self);
 
-        return NO;
+        return ret;
 }
 
 
 static int
-__line_has_md5str (const char *line)
+have_foreign_devs (void)
 {
-        int i = 0;
-        int ch = 0;
+        struct le_reader *self = NULL;
+        struct protset   *set = NULL;
+        int               ret = NO;
 
-        for (i = 0; i < 32; i++) {
-                ch = line[i];
-                if (!isxdigit (ch))
-                        return NO;
+        self = reader_enter ();
+        {
+                set = __atomic_load_n (&protect.set, __ATOMIC_ACQUIRE);
+                ret = (set && set->foreigncnt) ? YES : NO;
         }
+        reader_exit (self);
 
-        ch = line[i];
-        if (!isspace (ch))
-                return NO;
+        return ret;
+}
+#endif
 
-        for (ch = line[i]; (ch = line[i]) && (isspace (ch)); i++);
 
-        for (ch = line[i]; (ch = line[i]); i++)
-                if (!isascii (ch))
-                        return NO;
+#ifdef LE_WRITEDIGEST
+/* a file elsewhere can never be renamed over a protected entry */
+static int
+is_protected_dev (dev_t dev)
+{
+        struct le_reader *self = NULL;
+        struct protset   *set = NULL;
+        int               i = 0;
+        int               ret = NO;
 
-        return YES;
+        self = reader_enter ();
+        {
+                set = __atomic_load_n (&protect.set, __ATOMIC_ACQUIRE);
+                if (set && set->devcnt < 0)
+                        ret = YES;
+                for (i = 0; set && i < set->devcnt; i++) {
+                        if (set->devs[i] == dev) {
+                                ret = YES;
+                                break;
+                        }
+                }
+        }
+        reader_exit (self);
+
+        return ret;
 }
+#endif
+
+
+/* verdicts on open fds, indexed by fd. an fd keeps its inode for as
+   long as it is open, so the verdict is filled in when the fd is created
+   (or first checked) and dropped by the close and dup traps. the high
+   byte holds the low bits of protect.gen the verdict was taken under,
+   so a rehash invalidates every entry. fds beyond the table, and fds we
+   never saw created, fall back to fstat.
+
+   a stale entry would take an fd closed behind our back and its number
+   handed out again behind our back too, and a stale "not protected" on
+   a protected file lets fchmod through. so close_range and closefrom
+   drop what they close, and fopen, freopen and opendir, which open
+   inside libc without the open traps, drop the entry of the fd they
+   got. exec starts the new image with an empty table. what is left
+   (raw syscalls, SCM_RIGHTS after such a close) gets past the path
+   checks as well.
+*/
+#ifndef LE_STATIC
+#define FDTABLE_SIZE    65536
+#else
+/* nothing sees fds being closed or duplicated, so nothing is kept */
+#define FDTABLE_SIZE    0
+#endif
+
+#define FD_KNOWN        0x01
+#define FD_PROTECTED    0x02
+#define FD_PARENT       0x04    /* a directory holding protected entries */
+#define FD_FOREIGN      0x08    /* a directory on a remote device */
+
+
+/* never less than one entry, so that gcc has no zero-sized object to
+   warn about in the bounds-checked accessors */
+static unsigned short fdtable[FDTABLE_SIZE ? FDTABLE_SIZE : 1];
 
 
 static int
-xnum (char ch)
+fdtable_get (int fd)
 {
-        int n = 0;
+        unsigned short ent = 0;
+        unsigned int   gen = 0;
 
-        if (isdigit (ch))
-                n = (ch - '0');
-        if (ch >= 'a' && ch <= 'f')
-                n = (ch - 'a' + 10);
-        if (ch >= 'A' && ch <= 'F')
-                n = (ch - 'A' + 10);
+        if (fd < 0 || fd >= FDTABLE_SIZE)
+                return 0;
 
-        return n;
+        ent = __atomic_load_n (&fdtable[fd], __ATOMIC_RELAXED);
+        gen = __atomic_load_n (&protect.gen, __ATOMIC_ACQUIRE);
+
+        if ((ent >> 8) != (gen & 0xff))
+                return 0;
+
+        return ent & 0xff;
 }
 
 
 static void
-md5str_to_md5sum (const char *str, unsigned char *sum)
+fdtable_set (int fd, int flags, unsigned int gen)
 {
-        int  i = 0;
-        int  j = 0;
-        int  ch = 0;
+        if (fd < 0 || fd >= FDTABLE_SIZE)
+                return;
 
-        for (i = 0; i < 32; i++) {
-                if (!(i % 2)) {
-                        ch = xnum (str[i]);
-                        continue;
-                }
-                ch <<= 4;
-                ch += xnum (str[i]);
+        __atomic_store_n (&fdtable[fd], ((gen & 0xff) << 8) | flags,
+                          __ATOMIC_RELAXED);
+}
 
-                sum[j] = ch;
-                j++;
-        }
+
+static void
+fdtable_forget (int fd)
+{
+        fdtable_set (fd, 0, 0);
 }
 
 
+#if defined (HAVE_CLOSE_RANGE) || defined (HAVE_CLOSEFROM)
+/* [first, last] */
+static void
+fdtable_forget_range (unsigned int first, unsigned int last)
+{
+        unsigned int fd = 0;
+
+        if (last >= FDTABLE_SIZE)
+                last = FDTABLE_SIZE - 1;
+
+        for (fd = first; fd <= last && fd < FDTABLE_SIZE; fd++)
+                fdtable_forget (fd);
+}
+#endif
+
+
+static void
+fdtable_dup (int oldfd, int newfd)
+{
+        fdtable_set (newfd, fdtable_get (oldfd), protect.gen);
+}
+
 
 static int
-permits_parse (FILE *fp)
+fdtable_class (const struct stat *stbuf)
 {
-        struct permit_entry *entry = NULL;
-        struct permit_entry *next = NULL;
-        struct permit_entry *head = NULL;
-        char                 line[1024];
-        char                *l = NULL;
+        int flags = FD_KNOWN;
 
-        while ((l = fgets (line, 1024, fp))) {
-                if (strlen (l) < 35)
-                        continue;
-                if (__line_has_md5str (l) != YES)
-                        continue;
+        if (is_protected_ino (stbuf->st_dev, stbuf->st_ino))
+                flags |= FD_PROTECTED;
 
-                entry = calloc (1, sizeof (*entry));
-                if (!entry)
-                        goto err;
-                entry->next = head;
-                head = entry;
+#ifdef LE_PARENTFILTER
+        if (S_ISDIR (stbuf->st_mode) &&
+            is_parent_ino (stbuf->st_dev, stbuf->st_ino))
+                flags |= FD_PARENT;
+#endif
+#ifdef LE_DEVFILTER
+        if (S_ISDIR (stbuf->st_mode) && is_foreign_dev (stbuf->st_dev))
+                flags |= FD_FOREIGN;
+#endif
 
-                md5str_to_md5sum (l, entry->md5sum);
+        return flags;
+}
 
-                for (l = &line[32]; *l; l++)
-                        if (!isspace (*l))
-                                break;
-                if (!(*l))
-                        goto err;
 
-                entry->path = strdup (l);
-                if (!entry->path)
-                        goto err;
+static int
+fdtable_fill (int fd)
+{
+        struct stat   mystat = {0, };
+        int           ret = 0;
+        int           flags = 0;
+        unsigned int  gen = 0;
 
-                l = strchr (entry->path, '\n');
-                if (l)
-                        *l = '\0';
+        flags = fdtable_get (fd);
+        if (flags & FD_KNOWN)
+                return flags;
 
-                l = strchr (entry->path, '\r');
-                if (l)
-                        *l = '\0';
-        }
+        gen = __atomic_load_n (&protect.gen, __ATOMIC_ACQUIRE);
 
-        protect.permits = head;
+        ret = le_statat (fd, "", AT_EMPTY_PATH, 0, &mystat);
+        if (ret)
+                return 0;
 
-        return YES;
-err:
+        flags = fdtable_class (&mystat);
 
-        for (entry = head; entry; entry = next) {
-                next = entry->next;
-                if (entry->path)
-                        free (entry->path);
-                free (entry);
-        }
+        fdtable_set (fd, flags, gen);
 
-        return NO;
+        return flags;
 }
 
 
 static int
-permits_load (void)
+__is_protected_fd (int fd)
 {
-        const char *permitfile = NULL;
-        FILE       *permitfp = NULL;
-        struct stat stbuf;
-        int         ret = 0;
+        return (fdtable_fill (fd) & FD_PROTECTED) ? YES : NO;
+}
 
 
-        if (protect.permits)
-                return YES;
+#if defined (LE_PARENTFILTER) || defined (LE_DEVFILTER)
+/* a name looked up in a directory without walking through another */
+static int
+is_single_name (const char *name)
+{
+        if (!name || !name[0] || strchr (name, '/'))
+                return NO;
+
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                return NO;
+
+        return YES;
+}
+#endif
+
+
+#ifdef LE_DEVFILTER
+static int
+is_foreign_dir (int dirfd)
+{
+        struct stat dirstat = {0, };
+
+        if (!have_foreign_devs ())
+                return NO;
+
+        if (dirfd != AT_FDCWD)
+                return (fdtable_fill (dirfd) & FD_FOREIGN) ? YES : NO;
+
+        if (le_statat (AT_FDCWD, ".", 0, 0, &dirstat) != 0)
+                return NO;
+
+        return is_foreign_dev (dirstat.st_dev);
+}
+#endif
+
+
+/* stbuf, if given, receives the stat of the entry when one was taken.
+   its st_ino stays 0 when the verdict came without one.
+*/
+static int
+__is_protected_atpath (int dirfd, const char *path, int follow,
+                       struct stat *stbuf)
+{
+        struct stat mystat = {0, };
+        int         ret = 0;
+        int         flags = AT_SYMLINK_NOFOLLOW;
+
+#ifdef LE_DEVFILTER
+        /* a symlink could lead anywhere, only the entry itself is known
+           to live on the device of its directory */
+        if (!follow && is_single_name (path) && is_foreign_dir (dirfd))
+                return NO;
+#endif
+
+        if (follow)
+                flags = 0;
+
+        ret = le_statat (dirfd, path, flags, 0, &mystat);
+        if (ret)
+                return NO;
+
+        if (stbuf)
+                *stbuf = mystat;
+
+        return is_protected_ino (mystat.st_dev, mystat.st_ino);
+}
+
+
+static int
+__is_protected_atfile (int dirfd, const char *path)
+{
+        return __is_protected_atpath (dirfd, path, 1, NULL);
+}
+
+
+static int
+is_protected_atfile (int dirfd, const char *path)
+{
+        return __is_protected_atfile (dirfd, path);
+}
+
+
+static int
+__is_protected_atentry (int dirfd, const char *path)
+{
+        return __is_protected_atpath (dirfd, path, 0, NULL);
+}
+
+
+static int
+is_protected_atentry (int dirfd, const char *path)
+{
+        return __is_protected_atentry (dirfd, path);
+}
+
+
+static int
+is_protected_file (const char *path)
+{
+        return __is_protected_atfile (AT_FDCWD, path);
+}
+
+
+static int
+is_protected_entry (const char *path)
+{
+        return __is_protected_atentry (AT_FDCWD, path);
+}
+
+
+#ifdef LE_PARENTFILTER
+/* a single name can only be a protected entry if the directory it is
+   looked up in holds one. the verdict is then about the directory entry
+   rather than the inode behind it: another hard link to a protected file,
+   from a directory holding none, may be unlinked or renamed over. that
+   only drops a link, the protected name and its contents stay. the
+   inode checks of chmod, chown, truncate and open are not affected.
+
+   the directory class comes from the fd table, so a dirfd reused behind
+   our back carries the class of the directory it replaced.
+   ./configure --enable-parentfilter turns this on.
+*/
+#endif
+
+
+static int
+is_protected_dirent (int dirfd, const char *name, struct stat *stbuf)
+{
+#ifdef LE_PARENTFILTER
+        if (dirfd != AT_FDCWD && is_single_name (name) &&
+            !(fdtable_fill (dirfd) & FD_PARENT))
+                return NO;
+#endif
+
+        return __is_protected_atpath (dirfd, name, 0, stbuf);
+}
+
+
+static int
+is_protected_fd (int fd)
+{
+        return __is_protected_fd (fd);
+}
+
+
+static time_t
+get_default_deadline (void)
+{
+        struct stat epoch_stat = {0, };
+        int         ret = 0;
+        time_t      epoch = 0;
+
+        ret = lstat (EPOCH_FILE, &epoch_stat);
+        if (ret != 0)
+                return 0;
+
+        epoch = epoch_stat.st_ctime;
+        if (epoch_stat.st_mtime < epoch)
+                epoch = epoch_stat.st_mtime;
+        if (epoch_stat.st_atime < epoch)
+                epoch = epoch_stat.st_atime;
+
+        return (epoch + default_timeout);
+}
+
+
+/* license.asc holds one "MACID EXPIRY [HOST ENV]" line per machine,
+   of which this node's are found with memmem() over the mapped file
+   rather than by tokenizing every line. a large license may carry its
+   lines sorted by macid between a "#index" and a "#end" line, which is
+   searched by bisection instead (gluster-lic-sign -i). other readers
+   of the file need not know: the section is made of ordinary lines.
+*/
+#define LICENSE_INDEX   "\n#index"
+#define LICENSE_END     "\n#end"
+
+
+static int
+license_isdelim (char c)
+{
+        return c == ' ' || c == '\r' || c == '\n' || c == '\t';
+}
+
+
+static const char *
+license_eol (const char *p, const char *end)
+{
+        const char *nl = memchr (p, '\n', end - p);
+
+        return nl ? nl : end;
+}
+
+
+/* the expiry following the macid which ends at p, if the line is well
+   formed: nothing but blanks around the macid, digits after it */
+static time_t
+license_expiry (const char *p, const char *end)
+{
+        time_t ts = 0;
+
+        if (p < end && !license_isdelim (*p))
+                return 0;
+
+        while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+        if (p == end || !isdigit ((unsigned char) *p))
+                return 0;
+
+        while (p < end && isdigit ((unsigned char) *p))
+                ts = ts * 10 + (*p++ - '0');
+        if (p < end && !license_isdelim (*p))
+                return 0;
+
+        return ts;
+}
+
+
+/* the latest expiry of this node's lines in [p, end), p being at the
+   start of a line */
+static time_t
+license_scan (const char *p, const char *end)
+{
+        const char *macid = protect.macid;
+        size_t      len = strlen (macid);
+        const char *start = p;
+        const char *hit = NULL;
+        const char *q = NULL;
+        time_t      final_ts = 0;
+        time_t      ts = 0;
+
+        if (!len)
+                return 0;
+
+        while ((hit = memmem (p, end - p, macid, len))) {
+                p = hit + len;
+
+                /* only blanks back to the start of the line */
+                for (q = hit; q > start && (q[-1] == ' ' || q[-1] == '\t');
+                     q--)
+                        ;
+                if (q > start && q[-1] != '\n')
+                        continue;
+
+                ts = license_expiry (p, end);
+                dbg ("found entry macid=%s expiry=%llu\n", macid,
+                     (unsigned long long) ts);
+                if (ts > final_ts)
+                        final_ts = ts;
+        }
+
+        return final_ts;
+}
+
+
+/* compare the macid of the line at p with this node's */
+static int
+license_keycmp (const char *p, const char *end)
+{
+        const char *macid = protect.macid;
+        size_t      len = strlen (macid);
+        size_t      klen = 0;
+        int         ret = 0;
+
+        while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+        while (p + klen < end && !license_isdelim (p[klen]))
+                klen++;
+
+        ret = memcmp (p, macid, klen < len ? klen : len);
+        if (ret == 0)
+                ret = (klen > len) - (klen < len);
+
+        return ret;
+}
+
+
+/* lower bound of this node's macid among the sorted lines in [lo, hi),
+   both at the start of a line, and the latest expiry from there */
+static time_t
+license_lookup (const char *lo, const char *hi)
+{
+        const char *end = hi;
+        const char *mid = NULL;
+        const char *line = NULL;
+        const char *nl = NULL;
+        time_t      final_ts = 0;
+        time_t      ts = 0;
+
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                nl = memrchr (lo, '\n', mid - lo);
+                line = nl ? nl + 1 : lo;
+
+                if (license_keycmp (line, hi) < 0) {
+                        nl = license_eol (mid, hi);
+                        lo = (nl < hi) ? nl + 1 : hi;
+                } else
+                        hi = line;
+        }
+
+        for (line = lo; line < end; line = nl + 1) {
+                nl = license_eol (line, end);
+                if (license_keycmp (line, nl) != 0)
+                        break;
+                while (*line == ' ' || *line == '\t')
+                        line++;
+                ts = license_expiry (line + strlen (protect.macid), nl);
+                dbg ("found indexed entry macid=%s expiry=%llu\n",
+                     protect.macid, (unsigned long long) ts);
+                if (ts > final_ts)
+                        final_ts = ts;
+        }
+
+        return final_ts;
+}
+
+
+/* the "#end" line closing the index, looked for backwards from the end
+   of the file: only the signature should come after it */
+static const char *
+license_index_end (const char *first, const char *end)
+{
+        size_t      len = strlen (LICENSE_END);
+        const char *p = end;
+        const char *nl = NULL;
+
+        while (p > first && (nl = memrchr (first, '\n', p - first))) {
+                if ((size_t) (end - nl) >= len &&
+                    memcmp (nl, LICENSE_END, len) == 0 &&
+                    (nl + len == end || nl[len] == '\n' || nl[len] == '\r'))
+                        return nl;
+                p = nl;
+        }
+
+        return NULL;
+}
+
+
+static time_t
+license_parse (const char *buf, size_t len)
+{
+        const char *end = buf + len;
+        const char *index = NULL;
+        const char *first = NULL;
+        const char *last = NULL;
+        time_t      final_ts = 0;
+        time_t      ts = 0;
+        char        timebuf[64];
+
+        for (index = buf; (index = memmem (index, end - index, LICENSE_INDEX,
+                                           strlen (LICENSE_INDEX)));
+             index++) {
+                first = index + strlen (LICENSE_INDEX);
+                if (first < end && *first == '\r')
+                        first++;
+                if (first < end && *first == '\n')
+                        break;
+        }
+
+        if (index)
+                last = license_index_end (first, end);
+
+        if (index && last) {
+                final_ts = license_scan (buf, index + 1);
+                ts = license_lookup (first + 1, last + 1);
+                if (ts > final_ts)
+                        final_ts = ts;
+                ts = license_scan (last + 1, end);
+                if (ts > final_ts)
+                        final_ts = ts;
+        } else {
+                final_ts = license_scan (buf, end);
+        }
+
+        dbg ("final timestamp = %llu (%s)\n", (unsigned long long) final_ts,
+             strip_n (ctime_r (&final_ts, timebuf)));
+
+        return final_ts;
+}
+
+
+static time_t
+get_license_deadline (void)
+{
+        int                  ret = 0;
+        struct stat          lic_stat = {0, };
+        static struct stat   lic_stat_prev = {0, };
+        static time_t        lic_deadline = 0;
+        time_t               deadline = 0;
+        int                  fd = -1;
+        void                *buf = NULL;
+
+        /* be symlink friendly */
+        ret = stat (LICFILE, &lic_stat);
+        if (ret)
+                return 0;
+
+        if (lic_stat.st_mtime == lic_stat_prev.st_mtime &&
+            lic_stat.st_ctime == lic_stat_prev.st_ctime &&
+            lic_stat.st_ino   == lic_stat_prev.st_ino &&
+            lic_stat.st_dev   == lic_stat_prev.st_dev) {
+                /* nothing changed */
+                return lic_deadline;
+        }
+
+        fd = open (LICFILE, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+                return 0;
+
+        ret = is_signed_fd (fd);
+        if (ret != YES)
+                goto out;
+
+        /* the file verified, which need not be what stat() saw */
+        if (fstat (fd, &lic_stat) != 0 || lic_stat.st_size == 0)
+                goto out;
+
+        buf = mmap (NULL, lic_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buf == MAP_FAILED)
+                goto out;
+
+        deadline = license_parse (buf, lic_stat.st_size);
+        lic_deadline = deadline;
+        lic_stat_prev = lic_stat;
+
+        munmap (buf, lic_stat.st_size);
+out:
+        close (fd);
+
+        return deadline;
+}
+
+
+static time_t
+get_latest_deadline (void)
+{
+        time_t              def_deadline = 0;
+        time_t              lic_deadline = 0;
+        time_t              deadline = 0;
+        char                timebuf1[64];
+        char                timebuf2[64];
+
+        def_deadline = get_default_deadline ();
+        lic_deadline = get_license_deadline ();
+
+        dbg ("def_deadline = %s lic_deadline=%s\n",
+             strip_n (ctime_r (&def_deadline, timebuf1)),
+             strip_n (ctime_r (&lic_deadline, timebuf2)));
+
+        deadline = MAX (def_deadline, lic_deadline);
+
+        return deadline;
+}
+
+
+#define WATCH_PERIOD    SECS(10)
+
+/* why the watcher woke up */
+#define WOKE_PERIOD     0x01    /* polling: nothing to wait on */
+#define WOKE_FILES      0x02    /* the epoch, defaults or license changed */
+#define WOKE_DEADLINE   0x04    /* the deadline came, or the clock was set */
+#define WOKE_PROBE      0x08    /* time to see whether there is a publisher */
+#define WOKE_ORPHAN     0x10    /* the publisher went away */
+
+
+#ifdef LE_SHAREDDEADLINE
+/* one licensed process per node, whichever holds the flock() on
+   DEADLINE_FILE, works the deadline out and publishes it there. the
+   other watchers map the file read-only and take the published value
+   instead of stat()ing the epoch and verifying the license themselves.
+
+   the lock is the only liveness test: it goes away with the publisher,
+   and the next watcher to probe takes over, or works the deadline out
+   on its own if it may not write the file. the others probe once every
+   WATCH_PROBE, which also picks up what was published meanwhile, and
+   before acting on a passed deadline. a forked child shares the
+   publisher's lock, so it gives up its copies of the descriptors
+   without unlocking.
+*/
+#define DEADLINE_MAGIC  0x6c656464      /* "ledd" */
+#define DEADLINE_VER    1
+#define DEADLINE_PROBE  (MINS(1) / WATCH_PERIOD)
+#define WATCH_PROBE     MINS(1)
+
+
+struct deadline_seg {
+        uint32_t             magic;
+        uint32_t             version;
+        uint32_t             seq;       /* odd while being written */
+        int32_t              publisher;
+        uint64_t             gen;       /* bumped when deadline changes */
+        int64_t              deadline;
+};
+
+
+static struct {
+        const struct deadline_seg *seg;
+        struct deadline_seg  *wseg;     /* the publisher's mapping */
+        pthread_mutex_t      lock;
+        int                  fd;        /* the publisher's lock */
+        int                  wfd;
+        dev_t                dev;
+        ino_t                ino;
+        int                  publisher;
+        unsigned int         rounds;
+} dls = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .fd = -1,
+        .wfd = -1,
+};
+
+
+static void
+deadline_map (void)
+{
+        struct deadline_seg *seg = NULL;
+        struct stat          stbuf;
+        int                  fd = -1;
+
+        fd = le_openat (AT_FDCWD, DEADLINE_FILE,
+                        O_RDONLY | O_NOFOLLOW | O_CLOEXEC, 0);
+        if (fd == -1)
+                return;
+
+        if (fstat (fd, &stbuf) == 0 &&
+            stbuf.st_size >= (off_t) sizeof (*seg)) {
+                seg = mmap (NULL, sizeof (*seg), PROT_READ, MAP_SHARED,
+                            fd, 0);
+                if (seg != MAP_FAILED)
+                        dls.seg = seg;
+        }
+
+        close (fd);
+}
+
+
+static void
+deadline_resign (void)
+{
+        if (dls.wseg)
+                munmap (dls.wseg, sizeof (*dls.wseg));
+        dls.wseg = NULL;
+        dls.fd = -1;
+        dls.wfd = -1;
+        dls.publisher = NO;
+}
+
+
+static int
+deadline_fd_mine (int fd)
+{
+        struct stat stbuf;
+
+        return (fd >= 0 && fstat (fd, &stbuf) == 0 &&
+                stbuf.st_dev == dls.dev && stbuf.st_ino == dls.ino);
+}
+
+
+/* still ours, or were the descriptors closed or reused behind our back? */
+static int
+deadline_still_mine (void)
+{
+        if (deadline_fd_mine (dls.fd) && deadline_fd_mine (dls.wfd))
+                return YES;
+
+        dbg ("%s: lost the publisher's descriptors\n", DEADLINE_FILE);
+
+        deadline_resign ();
+
+        return NO;
+}
+
+
+/* YES if there is a publisher. this process may have just become it.
+   the close that wakes the watchers when a publisher exits comes a
+   moment before its lock goes: given the gone publisher's pid, wait
+   a little for that, unless another watcher has already taken over */
+static int
+deadline_probe (pid_t gone)
+{
+        struct deadline_seg *seg = NULL;
+        struct stat          stbuf;
+        int                  fd = -1;
+        int                  wfd = -1;
+        int                  tries = 0;
+        int                  saved_errno = 0;
+
+        fd = le_openat (AT_FDCWD, DEADLINE_FILE,
+                        O_RDONLY | O_NOFOLLOW | O_CLOEXEC, 0);
+        if (fd == -1 && errno == ENOENT) {
+                wfd = le_openat (AT_FDCWD, DEADLINE_FILE,
+                                 O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+                                 0644);
+                if (wfd == -1)
+                        return NO;
+                close (wfd);
+                fd = le_openat (AT_FDCWD, DEADLINE_FILE,
+                                O_RDONLY | O_NOFOLLOW | O_CLOEXEC, 0);
+        }
+        if (fd == -1)
+                return NO;
+
+        while (flock (fd, LOCK_EX | LOCK_NB) != 0) {
+                saved_errno = errno;
+                if (saved_errno == EWOULDBLOCK && gone && dls.seg &&
+                    dls.seg->publisher == gone && tries++ < 100) {
+                        usleep (1000);
+                        continue;
+                }
+                close (fd);
+                return (saved_errno == EWOULDBLOCK) ? YES : NO;
+        }
+
+        wfd = le_openat (AT_FDCWD, DEADLINE_FILE,
+                         O_RDWR | O_NOFOLLOW | O_CLOEXEC, 0);
+        if (wfd == -1 || fstat (wfd, &stbuf) != 0)
+                goto fail;
+
+        /* growing it is idempotent, and done by the lock holder only */
+        if (stbuf.st_size < (off_t) sizeof (*seg) &&
+            ftruncate (wfd, sizeof (*seg)) != 0)
+                goto fail;
+
+        seg = mmap (NULL, sizeof (*seg), PROT_READ | PROT_WRITE, MAP_SHARED,
+                    wfd, 0);
+        if (seg == MAP_FAILED)
+                goto fail;
+
+        if (!dls.seg)
+                deadline_map ();
+        if (!dls.seg) {
+                munmap (seg, sizeof (*seg));
+                goto fail;
+        }
+
+        dls.fd = fd;
+        dls.wfd = wfd;
+        dls.wseg = seg;
+        dls.dev = stbuf.st_dev;
+        dls.ino = stbuf.st_ino;
+        dls.publisher = YES;
+
+        if (seg->magic != DEADLINE_MAGIC || seg->version != DEADLINE_VER) {
+                __atomic_store_n (&seg->magic, 0, __ATOMIC_RELAXED);
+                __atomic_thread_fence (__ATOMIC_RELEASE);
+                memset (seg, 0, sizeof (*seg));
+                seg->version = DEADLINE_VER;
+                __atomic_store_n (&seg->magic, DEADLINE_MAGIC,
+                                  __ATOMIC_RELEASE);
+        }
+        seg->publisher = getpid ();
+
+        dbg ("%s: publishing from pid %d\n", DEADLINE_FILE, getpid ());
+
+        return YES;
+fail:
+        if (wfd != -1)
+                close (wfd);
+        flock (fd, LOCK_UN);
+        close (fd);
+
+        return NO;
+}
+
+
+static void
+deadline_publish (time_t deadline)
+{
+        struct deadline_seg *seg = dls.wseg;
+        uint32_t             seq = 0;
+
+        if (seg->deadline == deadline && seg->gen)
+                return;
+
+        /* odd if a publisher died writing */
+        seq = (seg->seq + 1) & ~1U;
+        __atomic_store_n (&seg->seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence (__ATOMIC_RELEASE);
+        seg->deadline = deadline;
+        seg->gen++;
+        __atomic_store_n (&seg->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+static int
+deadline_read (time_t *deadline, uint64_t *gen)
+{
+        const struct deadline_seg *seg = dls.seg;
+        uint32_t                   seq = 0;
+        int                        tries = 0;
+
+        if (__atomic_load_n (&seg->magic, __ATOMIC_ACQUIRE) != DEADLINE_MAGIC)
+                return -1;
+
+        for (tries = 0; tries < 100; tries++) {
+                seq = __atomic_load_n (&seg->seq, __ATOMIC_ACQUIRE);
+                if (seq & 1) {
+                        sched_yield ();
+                        continue;
+                }
+                *deadline = seg->deadline;
+                *gen = seg->gen;
+                __atomic_thread_fence (__ATOMIC_ACQUIRE);
+                if (__atomic_load_n (&seg->seq, __ATOMIC_RELAXED) == seq)
+                        return (*gen != 0) ? 0 : -1;
+        }
+
+        return -1;
+}
+
+
+static void
+deadline_atfork_child (void)
+{
+        pthread_mutex_init (&dls.lock, NULL);
+
+        if (dls.publisher) {
+                /* the same open files as the parent's: closing our
+                   copies keeps its lock, LOCK_UN would not. a number
+                   the program dup2()ed over is its own now */
+                if (deadline_fd_mine (dls.fd))
+                        close (dls.fd);
+                if (deadline_fd_mine (dls.wfd))
+                        close (dls.wfd);
+                deadline_resign ();
+        }
+        dls.rounds = 0;
+}
+
+
+static int
+watched_files (void)
+{
+        return __atomic_load_n (&dls.publisher, __ATOMIC_RELAXED);
+}
+
+
+/* the deadline as the node's publisher has it, working it out here
+   when this process is the publisher or there is none */
+static time_t
+watched_deadline (int woke)
+{
+        time_t    deadline = 0;
+        uint64_t  gen = 0;
+        int       published = YES;
+        int       probe = NO;
+        pid_t     gone = 0;
+
+        probe = (woke & (WOKE_DEADLINE | WOKE_ORPHAN | WOKE_PROBE)) ||
+                ((woke & WOKE_PERIOD) && dls.rounds++ % DEADLINE_PROBE == 0);
+
+        pthread_mutex_lock (&dls.lock);
+
+        if (!dls.seg)
+                deadline_map ();
+
+        if (dls.publisher)
+                deadline_still_mine ();
+
+        if ((woke & WOKE_ORPHAN) && dls.seg)
+                gone = dls.seg->publisher;
+
+        if (!dls.publisher && (probe || !dls.seg))
+                published = deadline_probe (gone);
+
+        if (dls.publisher) {
+                deadline = get_latest_deadline ();
+                deadline_publish (deadline);
+                pthread_mutex_unlock (&dls.lock);
+                return deadline;
+        }
+
+        pthread_mutex_unlock (&dls.lock);
+
+        if (published && dls.seg && deadline_read (&deadline, &gen) == 0)
+                return deadline;
+
+        return get_latest_deadline ();
+}
+#else
+static int
+watched_files (void)
+{
+        return NO;
+}
+
+
+static time_t
+watched_deadline (int woke)
+{
+        return get_latest_deadline ();
+}
+#endif /* LE_SHAREDDEADLINE */
+
+
+/* time() reads the coarse clock, which can lag the timer that woke
+   the watcher by a tick: it would take the deadline for not yet come
+   and wait on a timer that is already due */
+static time_t
+wall_clock (void)
+{
+        struct timespec ts = {0, };
+
+        clock_gettime (CLOCK_REALTIME, &ts);
+
+        return ts.tv_sec;
+}
+
+
+#if defined (HAVE_INOTIFY_INIT1) && defined (HAVE_TIMERFD_CREATE)
+/* instead of looking every WATCH_PERIOD, wait for something that can
+   move the deadline: a change to one of the files it comes from, the
+   deadline itself coming, or the wall clock being set. the directories
+   are watched rather than the files, which may not exist yet or get
+   replaced by a rename; the license file is watched as well, for when
+   it is a symlink.
+
+   inotify instances are few (fs.inotify.max_user_instances, 128 by
+   default) and shared by everything the user runs, so only the
+   deadline's publisher takes one: a node needs a single instance
+   however many licensed processes it runs. the other watchers, and
+   every watcher without LE_SHAREDDEADLINE, arm their timer alone: for
+   the deadline, or for the next probe (WATCH_PROBE) or poll
+   (WATCH_PERIOD), whichever comes first. they read the published
+   deadline again before acting on a passed one, so a renewed license
+   is never missed, only a shortened one noticed late. if the timer
+   cannot be set up either, the watcher sleeps and polls.
+*/
+#define WATCH_EVENTS    (IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | \
+                         IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                         IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+
+struct watch {
+        int                  ifd;
+        int                  tfd;
+        int                  rootwd;
+        int                  licwd;
+        int                  filewd;
+};
+
+
+static const char *
+basename_of (const char *path)
+{
+        const char *slash = strrchr (path, '/');
+
+        return slash ? slash + 1 : path;
+}
+
+
+static void
+watch_init (struct watch *w)
+{
+        w->ifd = -1;
+        w->filewd = -1;
+
+        w->tfd = timerfd_create (CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (w->tfd == -1)
+                dbg ("watching by polling every %d seconds (%s)\n",
+                     WATCH_PERIOD, strerror (errno));
+}
+
+
+static void
+watch_files_stop (struct watch *w)
+{
+        if (w->ifd == -1)
+                return;
+
+        close (w->ifd);
+        w->ifd = -1;
+        w->filewd = -1;
+}
+
+
+static int
+watch_files_start (struct watch *w)
+{
+        if (w->ifd != -1)
+                return 0;
+
+        w->ifd = inotify_init1 (IN_CLOEXEC | IN_NONBLOCK);
+        if (w->ifd == -1)
+                goto err;
+
+        w->rootwd = inotify_add_watch (w->ifd, "/", WATCH_EVENTS);
+        w->licwd = inotify_add_watch (w->ifd, LICDIR, WATCH_EVENTS);
+        if (w->rootwd == -1 || w->licwd == -1)
+                goto err;
+
+        return 0;
+err:
+        dbg ("watching the files by polling every %d seconds (%s)\n",
+             WATCH_PERIOD, strerror (errno));
+        watch_files_stop (w);
+
+        return -1;
+}
+
+
+static int
+watch_event (struct watch *w, const struct inotify_event *ev)
+{
+        if (ev->mask & IN_Q_OVERFLOW)
+                return WOKE_FILES;
+
+        if (ev->wd == w->filewd)
+                return WOKE_FILES;
+
+        if ((ev->wd == w->rootwd || ev->wd == w->licwd) &&
+            (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))) {
+                /* the directory itself went: poll from now on */
+                watch_files_stop (w);
+                return WOKE_FILES;
+        }
+
+        if (!ev->len)
+                return 0;
+
+        if (ev->wd == w->rootwd &&
+            (strcmp (ev->name, basename_of (EPOCH_FILE)) == 0 ||
+             strcmp (ev->name, basename_of (DEFAULT_FILE)) == 0))
+                return WOKE_FILES;
+
+        if (ev->wd == w->licwd &&
+            strcmp (ev->name, basename_of (LICFILE)) == 0)
+                return WOKE_FILES;
+
+        return 0;
+}
+
+
+/* block until something worth a look happens. @files: wait on the
+   files the deadline comes from, which only its publisher does */
+static int
+watch_wait (struct watch *w, time_t deadline, int files)
+{
+        struct itimerspec    its = {{0, }, {0, }};
+        struct pollfd        pfd[2];
+        char                 buf[4096]
+                __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+        const struct inotify_event *ev = NULL;
+        ssize_t              len = 0;
+        uint64_t             ticks = 0;
+        char                *p = NULL;
+        int                  woke = 0;
+        int                  early = 0;
+        time_t               period = 0;
+        time_t               wake = 0;
+        time_t               now = 0;
+
+        if (w->tfd == -1) {
+                sleep (WATCH_PERIOD);
+                return WOKE_PERIOD;
+        }
+
+        if (!files)
+                watch_files_stop (w);
+        else if (watch_files_start (w) == 0)
+                /* a symlinked license may point somewhere new by now */
+                w->filewd = inotify_add_watch (w->ifd, LICFILE,
+                                               IN_MODIFY | IN_CLOSE_WRITE |
+                                               IN_ATTRIB);
+
+        /* the deadline is still good at its very second */
+        wake = deadline + 1;
+
+        if (w->ifd == -1) {
+                period = WATCH_PERIOD;
+                early = WOKE_PERIOD;
+#ifdef LE_SHAREDDEADLINE
+                if (!files) {
+                        period = WATCH_PROBE;
+                        early = WOKE_PROBE;
+                }
+#endif
+                now = wall_clock ();
+                if (now + period < wake)
+                        wake = now + period;
+                else
+                        early = 0;
+        }
+
+        its.it_value.tv_sec = wake;
+        if (timerfd_settime (w->tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+                             &its, NULL) != 0) {
+                sleep (WATCH_PERIOD);
+                return WOKE_PERIOD;
+        }
+
+        while (!woke) {
+                pfd[0].fd = w->tfd;
+                pfd[0].events = POLLIN;
+                pfd[1].fd = w->ifd;
+                pfd[1].events = POLLIN;
+
+                if (poll (pfd, (w->ifd == -1) ? 1 : 2, -1) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        sleep (WATCH_PERIOD);
+                        return WOKE_PERIOD;
+                }
+
+                /* ECANCELED when the clock was set: look again as well */
+                if (pfd[0].revents) {
+                        if (read (w->tfd, &ticks, sizeof (ticks)) > 0)
+                                woke |= early ? early : WOKE_DEADLINE;
+                        else if (errno == ECANCELED)
+                                woke |= WOKE_DEADLINE;
+                }
+
+                if (w->ifd != -1 && pfd[1].revents) {
+                        while ((len = read (w->ifd, buf, sizeof (buf))) > 0) {
+                                for (p = buf; p < buf + len;
+                                     p += sizeof (*ev) + ev->len) {
+                                        ev = (const struct inotify_event *) p;
+                                        woke |= watch_event (w, ev);
+                                        if (w->ifd == -1)
+                                                return woke;
+                                }
+                        }
+                }
+        }
+
+        return woke;
+}
+#else
+struct watch {
+        int                  unused;
+};
+
+
+static void
+watch_init (struct watch *w)
+{
+}
+
+
+static int
+watch_wait (struct watch *w, time_t deadline, int files)
+{
+        sleep (WATCH_PERIOD);
+
+        return WOKE_PERIOD;
+}
+#endif
+
+
+static struct {
+        time_t               deadline;  /* as last settled by the watcher */
+} bb;
+
+
+static void *
+bigbro_is_watching (void *data)
+{
+        int           can_live = YES;
+        int           woke = 0;
+        time_t        deadline = -1;
+        time_t        new_deadline = 0;
+        time_t        now = 0;
+        struct watch  watch;
+        char          timebuf1[64];
+        char          timebuf2[64];
+
+        watch_init (&watch);
+
+        /* in a forked child, sleep on the parent's deadline first */
+        woke = WOKE_PERIOD | WOKE_DEADLINE;
+        deadline = __atomic_load_n (&bb.deadline, __ATOMIC_RELAXED);
+        if (deadline > 0)
+                woke = watch_wait (&watch, deadline, watched_files ());
+
+        for (; can_live == YES;
+             woke = watch_wait (&watch, deadline, watched_files ())) {
+                new_deadline = watched_deadline (woke);
+                if (new_deadline < wall_clock ())
+                        new_deadline = watched_deadline (WOKE_DEADLINE);
+                if (deadline != new_deadline) {
+                        dbg ("updated deadline: %s\n",
+                             strip_n (ctime_r (&new_deadline, timebuf1)));
+                }
+                deadline = new_deadline;
+                __atomic_store_n (&bb.deadline, deadline, __ATOMIC_RELAXED);
+                now = wall_clock ();
+
+                if (deadline < now) {
+                        err ("deadline was: %s, now is: %s\n",
+                             strip_n (ctime_r (&deadline, timebuf1)),
+                             strip_n (ctime_r (&now, timebuf2)));
+                        /* >:) */
+                        break;
+                }
+        }
+
+        exit (1);
+
+        return NULL;
+}
+
+
+/* settled by libevil_init before main() runs, and only ever flipped
+   from NO to YES afterwards, by make_licensed_prog. every trap tests it
+   first, so a licensed process pays one well predicted branch per call
+   before going to the real function.
+*/
+static int  is_licensed = NO;
+
+
+/* the watcher mostly sleeps in poll(). its deepest path, checking the
+   license signature, needs a few tens of KB of stack, not the 8MB of
+   address space a thread gets by default */
+#define WATCH_STACK     (128 * 1024)
+
+
+static void
+bb_start (void)
+{
+        pthread_attr_t attr;
+        int            ret = 0;
+
+        pthread_attr_init (&attr);
+        pthread_attr_setstacksize (&attr, WATCH_STACK);
+
+        ret = pthread_create (&protect.bigbro, &attr, bigbro_is_watching,
+                              NULL);
+        if (ret != 0)
+                protect.bigbro = 0;
+
+        pthread_attr_destroy (&attr);
+}
+
+
+static time_t
+mono_clock (void)
+{
+        struct timespec ts = {0, };
+
+        clock_gettime (CLOCK_MONOTONIC_COARSE, &ts);
+
+        return ts.tv_sec;
+}
+
+
+/* the watcher is a thread, not a signal or a check riding on trapped
+   calls: the deadline has to be enforced in a process which is idle
+   when it passes, a timer signal would need a handler of ours in the
+   program's signal space, and one which kills outright could not
+   notice a renewed license. a forked child of a licensed program gets
+   its own watcher right away, seeded with the parent's deadline so it
+   starts out asleep. one which execs soon pays only for the thread.
+*/
+static void
+bb_child (void)
+{
+        if (!__atomic_load_n (&is_licensed, __ATOMIC_RELAXED))
+                return;
+
+#ifdef LE_SHAREDDEADLINE
+        deadline_atfork_child ();
+#endif
+
+        bb_start ();
+}
+
+
+/* registered before the program can turn licensed, so that a fork
+   racing with that still leaves the child watched */
+static void
+prepare_watch (void)
+{
+        int ret = 0;
+
+        ret = pthread_atfork (NULL, NULL, bb_child);
+        if (ret != 0)
+                dbg ("failed pthread_atfork (%s)\n", strerror (ret));
+}
+
+
+static inline int
+is_licensed_prog (void)
+{
+        return __builtin_expect (__atomic_load_n (&is_licensed,
+                                                  __ATOMIC_RELAXED), NO);
+}
+
+
+static void
+make_licensed_prog (void)
+{
+        if (__atomic_exchange_n (&is_licensed, YES, __ATOMIC_SEQ_CST) == YES)
+                return;
+
+        bb_start ();
+}
+
+
+#ifndef LE_STATIC
+static void
+detect_licensed_prog (void)
+{
+        int         i = 0;
+        const char *symbol = NULL;
+
+        for (i = 0; (symbol = licensed_symbols[i]); i++) {
+                if (dlsym (RTLD_NEXT, symbol) != NULL)
+                        break;
+        }
+
+        if (!symbol)
+                return;
+
+        dbg ("found symbol %s -- is a licensed program\n", symbol);
+        make_licensed_prog ();
+}
+#endif
+
+
+/* run gpgv on an already open file, fed to it as stdin. posix_spawn
+   does not copy the caller's address space and runs no atfork
+   handlers, and no shell is involved. the shared file offset is left
+   at the start again for the caller to read what was verified.
+*/
+static int
+gpgv_signed_fd (int fd)
+{
+        int                         ret = 0;
+        int                         status = 0;
+        pid_t                       pid = -1;
+        posix_spawn_file_actions_t  actions;
+        char                       *argv[] = {
+                "gpgv", "--keyring", LICDIR "/pubring.gpg", "-", NULL,
+        };
+        extern char               **environ;
+
+        if (lseek (fd, 0, SEEK_SET) != 0)
+                return NO;
+
+        if (posix_spawn_file_actions_init (&actions) != 0)
+                return NO;
+
+        if (posix_spawn_file_actions_adddup2 (&actions, fd, 0) != 0 ||
+            posix_spawn_file_actions_addopen (&actions, 1, "/dev/null",
+                                              O_WRONLY, 0) != 0 ||
+            posix_spawn_file_actions_adddup2 (&actions, 1, 2) != 0) {
+                posix_spawn_file_actions_destroy (&actions);
+                return NO;
+        }
+
+        ret = posix_spawn (&pid, LICDIR "/gpgv", &actions, NULL, argv,
+                           environ);
+        posix_spawn_file_actions_destroy (&actions);
+        if (ret != 0) {
+                dbg ("%s/gpgv: %s\n", LICDIR, strerror (ret));
+                return NO;
+        }
+
+        while ((ret = waitpid (pid, &status, 0)) < 0 && errno == EINTR)
+                ;
+
+        lseek (fd, 0, SEEK_SET);
+
+        dbg ("%s/gpgv on fd %d: %d\n", LICDIR, fd, status);
+
+        if (ret == pid && WIFEXITED (status) && WEXITSTATUS (status) == 0)
+                return YES;
+
+        return NO;
+}
+
+
+#ifdef LE_PGPVERIFY
+#define SIGNED_MAX (1024 * 1024)
+
+/* the whole of a small regular file, read from offset 0 */
+static char *
+read_small_fd (int fd, size_t *lenp)
+{
+        struct stat  stbuf;
+        char        *buf = NULL;
+        ssize_t      ret = 0;
+        size_t       len = 0;
+
+        if (fstat (fd, &stbuf) != 0 || !S_ISREG (stbuf.st_mode) ||
+            stbuf.st_size > SIGNED_MAX)
+                return NULL;
+
+        buf = malloc (stbuf.st_size + 1);
+        if (!buf)
+                return NULL;
+
+        while (len < (size_t) stbuf.st_size) {
+                ret = pread (fd, buf + len, stbuf.st_size - len, len);
+                if (ret < 0 && errno == EINTR)
+                        continue;
+                if (ret <= 0)
+                        break;
+                len += ret;
+        }
+
+        *lenp = len;
+
+        return buf;
+}
+
+
+/* check the signature against pubring.gpg right here, and ask gpgv
+   only about what pgp.c does not understand. the file offset ends up
+   at the start, as with gpgv.
+*/
+static int
+pgp_signed_fd (int fd)
+{
+        char    *text = NULL;
+        size_t   textlen = 0;
+        char    *keyring = NULL;
+        size_t   keylen = 0;
+        int      keyfd = -1;
+        int      ret = -1;
+
+        text = read_small_fd (fd, &textlen);
+
+        keyfd = open (LICDIR "/pubring.gpg", O_RDONLY | O_CLOEXEC);
+        if (keyfd != -1) {
+                keyring = read_small_fd (keyfd, &keylen);
+                close (keyfd);
+        }
+
+        if (text && keyring)
+                ret = pgp_verify_clearsign (text, textlen,
+                                            (uint8_t *) keyring, keylen);
+
+        free (text);
+        free (keyring);
+
+        dbg ("signature on fd %d: %d\n", fd, ret);
+
+        if (ret == -1)
+                return gpgv_signed_fd (fd);
+
+        lseek (fd, 0, SEEK_SET);
+
+        return ret;
+}
+#endif /* LE_PGPVERIFY */
+
+
+#ifdef LE_SIGCACHE
+/* verdicts shared by every process on the node. a good signature on a
+   file is remembered together with the file's identity and md5, and
+   the same for pubring.gpg, so that the next process to check the same
+   permit.asc or license.asc finds it here instead of verifying again.
+   only good verdicts are kept: a failure may as well have been a gpgv
+   that could not be started.
+
+   readers take no lock, each slot is a seqlock. writers serialize on
+   flock() of the file, which goes away with them if they die half way;
+   an odd sequence number seen under the lock is such a leftover. the
+   file is protected like pubring.gpg, so only the shim writes to it.
+   processes that may not open it for writing still use what is there,
+   without counting.
+*/
+#define SIGCACHE_MAGIC  0x6c657663      /* "levc" */
+#define SIGCACHE_VER    1
+#define SIGCACHE_ENTS   16
+
+
+struct sigcache_id {
+        uint64_t            dev;
+        uint64_t            ino;
+        uint64_t            size;
+        int64_t             mtime;
+        int64_t             mtime_ns;
+        int64_t             ctime;
+        int64_t             ctime_ns;
+        uint8_t             md5[16];
+};
+
+
+struct sigcache_ent {
+        uint32_t            seq;        /* odd while being written */
+        uint32_t            pad;
+        struct sigcache_id  file;
+        struct sigcache_id  keyring;
+};
+
+
+struct sigcache {
+        uint32_t            magic;
+        uint32_t            version;
+        uint64_t            hits;
+        uint64_t            misses;
+        struct sigcache_ent ents[SIGCACHE_ENTS];
+};
+
+
+static struct sigcache *sigcache;
+static int              sigcache_rw;
+static pthread_once_t   sigcache_once = PTHREAD_ONCE_INIT;
+
+
+static void
+sigcache_map (void)
+{
+        struct sigcache *map = NULL;
+        struct stat      stbuf;
+        int              fd = -1;
+        int              prot = PROT_READ | PROT_WRITE;
+
+        fd = le_openat (AT_FDCWD, SIGCACHE_FILE,
+                        O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+        if (fd == -1) {
+                prot = PROT_READ;
+                fd = le_openat (AT_FDCWD, SIGCACHE_FILE,
+                                O_RDONLY | O_NOFOLLOW | O_CLOEXEC, 0);
+        }
+        if (fd == -1) {
+                dbg ("%s: %s\n", SIGCACHE_FILE, strerror (errno));
+                return;
+        }
+
+        /* unlocked by hand below: the mapping keeps the open file, and
+           with it the lock, alive past close() */
+        if (prot & PROT_WRITE) {
+                flock (fd, LOCK_EX);
+                if (fstat (fd, &stbuf) == 0 &&
+                    stbuf.st_size != sizeof (struct sigcache)) {
+                        if (ftruncate (fd, 0) != 0 ||
+                            ftruncate (fd, sizeof (struct sigcache)) != 0)
+                                goto out;
+                }
+        }
+
+        if (fstat (fd, &stbuf) != 0 ||
+            stbuf.st_size != sizeof (struct sigcache))
+                goto out;
+
+        map = mmap (NULL, sizeof (*map), prot, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+                goto out;
+
+        if ((prot & PROT_WRITE) &&
+            (map->magic != SIGCACHE_MAGIC || map->version != SIGCACHE_VER)) {
+                memset (map, 0, sizeof (*map));
+                map->version = SIGCACHE_VER;
+                __atomic_store_n (&map->magic, SIGCACHE_MAGIC,
+                                  __ATOMIC_RELEASE);
+        }
+
+        if (__atomic_load_n (&map->magic, __ATOMIC_ACQUIRE) != SIGCACHE_MAGIC ||
+            map->version != SIGCACHE_VER) {
+                munmap (map, sizeof (*map));
+                goto out;
+        }
+
+        sigcache_rw = !!(prot & PROT_WRITE);
+        sigcache = map;
+out:
+        flock (fd, LOCK_UN);
+        close (fd);
+}
+
+
+static int
+sigcache_id_fd (int fd, struct sigcache_id *id)
+{
+        struct stat stbuf;
+
+        memset (id, 0, sizeof (*id));
+
+        if (fstat (fd, &stbuf) != 0 || !S_ISREG (stbuf.st_mode))
+                return -1;
+
+        id->dev = stbuf.st_dev;
+        id->ino = stbuf.st_ino;
+        id->size = stbuf.st_size;
+        id->mtime = stbuf.st_mtim.tv_sec;
+        id->mtime_ns = stbuf.st_mtim.tv_nsec;
+        id->ctime = stbuf.st_ctim.tv_sec;
+        id->ctime_ns = stbuf.st_ctim.tv_nsec;
+
+        return 0;
+}
+
+
+/* what a slot has to hold for @fd to have been verified already */
+static int
+sigcache_key (int fd, struct sigcache_ent *key)
+{
+        int keyfd = -1;
+        int ret = -1;
+
+        memset (key, 0, sizeof (*key));
+
+        if (sigcache_id_fd (fd, &key->file) != 0 ||
+            libevil_md5sum_fd (fd, key->file.md5) != 0)
+                return -1;
+
+        keyfd = open (LICDIR "/pubring.gpg", O_RDONLY | O_CLOEXEC);
+        if (keyfd == -1)
+                return -1;
+        ret = sigcache_id_fd (keyfd, &key->keyring);
+        if (ret == 0)
+                ret = libevil_md5sum_fd (keyfd, key->keyring.md5);
+        close (keyfd);
+        if (ret != 0)
+                return -1;
+
+        return 0;
+}
+
+
+static struct sigcache_ent *
+sigcache_slot (const struct sigcache_ent *key)
+{
+        uint64_t h = key->file.dev * 0x9e3779b97f4a7c15ULL ^ key->file.ino;
+
+        return &sigcache->ents[(h ^ (h >> 29)) % SIGCACHE_ENTS];
+}
+
+
+/* YES if @fd is known to be signed, NO if not known. fills @key for a
+   later sigcache_store(). -1 if the cache cannot be used for @fd */
+static int
+sigcache_lookup (int fd, struct sigcache_ent *key)
+{
+        struct sigcache_ent *slot = NULL;
+        struct sigcache_ent  copy;
+        uint32_t             seq = 0;
+        int                  ret = NO;
+
+        pthread_once (&sigcache_once, sigcache_map);
+        if (!sigcache)
+                return -1;
+
+        if (sigcache_key (fd, key) != 0)
+                return -1;
+
+        slot = sigcache_slot (key);
+
+        seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1)) {
+                memcpy (&copy.file, &slot->file, sizeof (copy.file));
+                memcpy (&copy.keyring, &slot->keyring,
+                        sizeof (copy.keyring));
+                __atomic_thread_fence (__ATOMIC_ACQUIRE);
+                if (__atomic_load_n (&slot->seq, __ATOMIC_RELAXED) == seq &&
+                    memcmp (&copy.file, &key->file, sizeof (copy.file)) == 0 &&
+                    memcmp (&copy.keyring, &key->keyring,
+                            sizeof (copy.keyring)) == 0)
+                        ret = YES;
+        }
+
+        if (sigcache_rw)
+                __atomic_fetch_add (ret == YES ? &sigcache->hits :
+                                    &sigcache->misses, 1, __ATOMIC_RELAXED);
+
+        dbg ("%s: %s on fd %d\n", SIGCACHE_FILE,
+             ret == YES ? "hit" : "miss", fd);
+
+        return ret;
+}
+
+
+/* remember that @fd verified, unless it changed since @key was taken */
+static void
+sigcache_store (int fd, const struct sigcache_ent *key)
+{
+        struct sigcache_ent *slot = NULL;
+        struct sigcache_ent  now;
+        uint32_t             seq = 0;
+        int                  lockfd = -1;
+
+        if (!sigcache_rw)
+                return;
+
+        if (sigcache_key (fd, &now) != 0 ||
+            memcmp (&now, key, sizeof (now)) != 0)
+                return;
+
+        lockfd = le_openat (AT_FDCWD, SIGCACHE_FILE,
+                            O_RDONLY | O_NOFOLLOW | O_CLOEXEC, 0);
+        if (lockfd == -1)
+                return;
+        flock (lockfd, LOCK_EX);
+
+        slot = sigcache_slot (key);
+
+        seq = __atomic_load_n (&slot->seq, __ATOMIC_RELAXED);
+        seq = (seq | 1) + 1;
+
+        __atomic_store_n (&slot->seq, seq - 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence (__ATOMIC_RELEASE);
+        memcpy (&slot->file, &key->file, sizeof (slot->file));
+        memcpy (&slot->keyring, &key->keyring, sizeof (slot->keyring));
+        __atomic_store_n (&slot->seq, seq, __ATOMIC_RELEASE);
+
+        flock (lockfd, LOCK_UN);
+        close (lockfd);
+}
+#endif /* LE_SIGCACHE */
+
+
+static int
+is_signed_fd (int fd)
+{
+        int                  ret = NO;
+#ifdef LE_SIGCACHE
+        struct sigcache_ent  key;
+        int                  cached = NO;
+
+        cached = sigcache_lookup (fd, &key);
+        if (cached == YES)
+                return YES;
+#endif
+
+#ifdef LE_PGPVERIFY
+        ret = pgp_signed_fd (fd);
+#else
+        ret = gpgv_signed_fd (fd);
+#endif
+
+#ifdef LE_SIGCACHE
+        if (ret == YES && cached == NO)
+                sigcache_store (fd, &key);
+#endif
+
+        return ret;
+}
+
+
+/* the digest field of a permit line, "HEX" or "ALGO:HEX". sets *algo
+   and *hex and returns where the field ends, or NULL if it is none */
+static const char *
+permit_line_digest (const char *line, const char *eol, int *algo,
+                    const char **hex)
+{
+        const char *end = NULL;
+        const char *colon = NULL;
+        const char *p = NULL;
+        int         i = 0;
+
+        for (end = line; end < eol && !isspace (*end); end++);
+
+        colon = memchr (line, ':', end - line);
+        if (!colon) {
+                *algo = PERMIT_MD5;
+                *hex = line;
+        } else {
+                for (i = 0; i < PERMIT_ALGOS; i++) {
+                        if (strlen (permit_algos[i].tag) ==
+                            (size_t) (colon - line) &&
+                            strncmp (line, permit_algos[i].tag,
+                                     colon - line) == 0)
+                                break;
+                }
+                if (i == PERMIT_ALGOS)
+                        return NULL;
+                *algo = i;
+                *hex = colon + 1;
+        }
+
+        if ((size_t) (end - *hex) != 2 * permit_algos[*algo].len)
+                return NULL;
+
+        for (p = *hex; p < end; p++) {
+                if (!isxdigit (*p))
+                        return NULL;
+        }
+
+        return end;
+}
+
+
+static int
+xnum (char ch)
+{
+        int n = 0;
+
+        if (isdigit (ch))
+                n = (ch - '0');
+        if (ch >= 'a' && ch <= 'f')
+                n = (ch - 'a' + 10);
+        if (ch >= 'A' && ch <= 'F')
+                n = (ch - 'A' + 10);
+
+        return n;
+}
+
+
+static void
+hexstr_to_digest (const char *str, unsigned char *sum, size_t len)
+{
+        size_t i = 0;
+
+        for (i = 0; i < len; i++)
+                sum[i] = (xnum (str[2 * i]) << 4) | xnum (str[2 * i + 1]);
+}
+
+
+/* the path of a permit line in [line, eol), up to any CR, or NULL.
+   *algo and *hex tell its digest */
+static const char *
+permit_line_path (const char *line, const char *eol, size_t *len,
+                  int *algo, const char **hex)
+{
+        const char *p = NULL;
+        const char *cr = NULL;
+
+        p = permit_line_digest (line, eol, algo, hex);
+        if (!p || p == eol)
+                return NULL;
+
+        for (; p < eol && isspace (*p); p++);
+        if (p == eol)
+                return NULL;
+
+        for (cr = p; cr < eol; cr++)
+                if (!isascii (*cr))
+                        return NULL;
+
+        cr = memchr (p, '\r', eol - p);
+        *len = (cr ? cr : eol) - p;
+
+        return p;
+}
+
+
+static unsigned int
+permtab_hash (int algo, const unsigned char *digest)
+{
+        uint32_t h = 0;
+
+        memcpy (&h, digest, sizeof (h));
+
+        return h ^ algo;
+}
+
+
+static struct permtab *
+permits_parse (const char *buf, size_t len, const struct stat *file)
+{
+        const char          *end = buf + len;
+        const char          *line = NULL;
+        const char          *eol = NULL;
+        const char          *path = NULL;
+        size_t               pathlen = 0;
+        size_t               count = 0;
+        size_t               bytes = 0;
+        size_t               slots = 8;
+        struct permtab      *tab = NULL;
+        struct permit_entry *entry = NULL;
+        struct stat          stbuf;
+        char                *strings = NULL;
+        const char          *hex = NULL;
+        unsigned char        digest[PERMIT_DIGEST_MAX];
+        unsigned int         algos = 0;
+        unsigned int         i = 0;
+        int                  algo = 0;
+        time_t               now = time (NULL);
+
+        for (line = buf; line < end; line = eol + 1) {
+                eol = memchr (line, '\n', end - line);
+                if (!eol)
+                        eol = end;
+                if (permit_line_path (line, eol, &pathlen, &algo, &hex)) {
+                        algos |= 1 << algo;
+                        count++;
+                        bytes += pathlen + 1;
+                }
+        }
+
+        if (algos & ~(1 << PERMIT_MD5))
+                algos &= ~(1 << PERMIT_MD5);
+
+        /* keep the load factor under 2/3 so probes stay short */
+        while (slots < count + count / 2 + 1)
+                slots <<= 1;
+
+        if (posix_memalign ((void **) &tab, 64, sizeof (*tab) +
+                            slots * sizeof (tab->ents[0]) + bytes))
+                return NULL;
+
+        memset (tab, 0, sizeof (*tab) + slots * sizeof (tab->ents[0]));
+        tab->mask = slots - 1;
+        tab->algos = algos;
+        tab->file = *file;
+        strings = (char *) &tab->ents[slots];
+
+        for (line = buf; line < end; line = eol + 1) {
+                eol = memchr (line, '\n', end - line);
+                if (!eol)
+                        eol = end;
+                path = permit_line_path (line, eol, &pathlen, &algo, &hex);
+                if (!path || !(algos & (1 << algo)))
+                        continue;
+
+                hexstr_to_digest (hex, digest, permit_algos[algo].len);
+
+                /* the same digest may be permitted on several paths */
+                for (i = permtab_hash (algo, digest) & tab->mask;
+                     tab->ents[i].path; i = (i + 1) & tab->mask);
+
+                entry = &tab->ents[i];
+                memcpy (entry->digest, digest, permit_algos[algo].len);
+                entry->algo = algo;
+
+                memcpy (strings, path, pathlen);
+                strings[pathlen] = '\0';
+                entry->path = strings;
+                strings += pathlen + 1;
+                tab->count++;
+
+                if (lstat (entry->path, &stbuf) != 0) {
+                        dbg ("%s: %s\n", entry->path, strerror (errno));
+                        continue;
+                }
+                /* a reused inode can share the ctime only within the
+                   same tick: one from this second is not remembered */
+                if (stbuf.st_ctime >= now)
+                        continue;
+                entry->dev = stbuf.st_dev;
+                entry->ino = stbuf.st_ino;
+                entry->ctime = stbuf.st_ctim;
+        }
+
+        dbg ("permitting %u entries in %u slots\n", tab->count, slots);
+
+        return tab;
+}
+
+
+/* the published table, rebuilt first if permit.asc changed. that is
+   looked at once a second at most, so that a rename it permits needs
+   no system call beyond hashing the source */
+#define PERMITS_RECHECK SECS(1)
+
+
+static int
+permits_load (void)
+{
+        static time_t   checked = 0;
+        const char     *permitfile = NULL;
+        struct permtab *tab = NULL;
+        struct permtab *old = NULL;
+        struct stat     stbuf;
+        void           *buf = MAP_FAILED;
+        int             fd = -1;
+        int             ret = 0;
+        time_t          now = 0;
+
+
+        now = mono_clock ();
+        if (__atomic_load_n (&protect.permits, __ATOMIC_ACQUIRE) &&
+            now - __atomic_load_n (&checked, __ATOMIC_RELAXED) <
+            PERMITS_RECHECK)
+                return YES;
+        __atomic_store_n (&checked, now, __ATOMIC_RELAXED);
+
+        permitfile = getenv ("LE_PERMIT");
+        if (!permitfile)
+                permitfile = PERMITFILE;
+
+        ret = stat (permitfile, &stbuf);
+        /* don't care if it is symlink */
+        if (ret != 0) {
+                dbg ("%s: %s\n", permitfile, strerror (errno));
+                return NO;
+        }
+
+        if (!S_ISREG (stbuf.st_mode)) {
+                dbg ("%s: Not a regular file\n", permitfile);
+                return NO;
+        }
+
+        old = __atomic_load_n (&protect.permits, __ATOMIC_ACQUIRE);
+        if (old && old->file.st_dev == stbuf.st_dev &&
+            old->file.st_ino == stbuf.st_ino &&
+            old->file.st_size == stbuf.st_size &&
+            old->file.st_mtim.tv_sec == stbuf.st_mtim.tv_sec &&
+            old->file.st_mtim.tv_nsec == stbuf.st_mtim.tv_nsec &&
+            old->file.st_ctim.tv_sec == stbuf.st_ctim.tv_sec &&
+            old->file.st_ctim.tv_nsec == stbuf.st_ctim.tv_nsec)
+                return YES;
+
+        fd = open (permitfile, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                dbg ("%s: %s\n", permitfile, strerror (errno));
+                return NO;
+        }
+
+        ret = is_signed_fd (fd);
+        if (ret != YES) {
+                dbg ("%s: signature check failed\n", permitfile);
+                close (fd);
+                return NO;
+        }
+
+        /* the file verified, which need not be what stat() saw */
+        if (fstat (fd, &stbuf) == 0 && stbuf.st_size > 0)
+                buf = mmap (NULL, stbuf.st_size, PROT_READ, MAP_PRIVATE,
+                            fd, 0);
+        close (fd);
+        if (buf == MAP_FAILED)
+                return NO;
+
+        tab = permits_parse (buf, stbuf.st_size, &stbuf);
+        munmap (buf, stbuf.st_size);
+        if (!tab)
+                return NO;
+
+        /* somebody else rebuilt it meanwhile: theirs is as good */
+        if (!__atomic_compare_exchange_n (&protect.permits, &old, tab, NO,
+                                          __ATOMIC_SEQ_CST,
+                                          __ATOMIC_SEQ_CST)) {
+                free (tab);
+                return YES;
+        }
+
+        if (old) {
+                synchronize_readers ();
+                free (old);
+        }
+
+        return YES;
+}
+
+
+static int
+permit_digest_fd (int fd, int algo, unsigned char *digest)
+{
+        switch (algo) {
+        case PERMIT_MD5:
+                return libevil_md5sum_fd (fd, digest);
+        case PERMIT_SHA256:
+                return sha256_fd (fd, digest);
+        case PERMIT_BLAKE3:
+                return blake3_fd (fd, digest);
+        }
+
+        return -1;
+}
+
+
+static struct digcache_ent *
+digcache_slot (const struct stat *stbuf, int algo)
+{
+        return &digcache.ents[(protset_hash (stbuf->st_dev, stbuf->st_ino) ^
+                               algo) & (DIGCACHE_ENTS - 1)];
+}
+
+
+static int
+digcache_same (const struct digcache_ent *ent, const struct stat *stbuf,
+               int algo)
+{
+        return ent->ino == stbuf->st_ino && ent->dev == stbuf->st_dev &&
+                ent->algo == algo && ent->size == stbuf->st_size &&
+                ent->mtime.tv_sec == stbuf->st_mtim.tv_sec &&
+                ent->mtime.tv_nsec == stbuf->st_mtim.tv_nsec &&
+                ent->ctime.tv_sec == stbuf->st_ctim.tv_sec &&
+                ent->ctime.tv_nsec == stbuf->st_ctim.tv_nsec;
+}
+
+
+static void
+digcache_put (const struct stat *stbuf, int algo, const unsigned char *digest)
+{
+        struct digcache_ent *ent = NULL;
+
+        LOCK (&digcache.lock);
+        {
+                ent = digcache_slot (stbuf, algo);
+                ent->dev = stbuf->st_dev;
+                ent->ino = stbuf->st_ino;
+                ent->size = stbuf->st_size;
+                ent->mtime = stbuf->st_mtim;
+                ent->ctime = stbuf->st_ctim;
+                ent->algo = algo;
+                memcpy (ent->digest, digest, permit_algos[algo].len);
+        }
+        UNLOCK (&digcache.lock);
+}
+
+
+/* the @algo digest of @fd, whose fstat is @stbuf. @now is when that
+   was taken: a file changed in that very second may change again
+   without moving its ctime, so its digest is not kept */
+static int
+permit_digest (int fd, const struct stat *stbuf, time_t now, int algo,
+               unsigned char *digest)
+{
+        struct digcache_ent *ent = NULL;
+        int                  ret = NO;
+
+        if (!digcache.ready)
+                return permit_digest_fd (fd, algo, digest);
+
+        LOCK (&digcache.lock);
+        {
+                ent = digcache_slot (stbuf, algo);
+                ret = digcache_same (ent, stbuf, algo);
+                if (ret) {
+                        memcpy (digest, ent->digest, permit_algos[algo].len);
+                        digcache.hits++;
+                } else {
+                        digcache.misses++;
+                }
+        }
+        UNLOCK (&digcache.lock);
+
+        if (ret)
+                return 0;
+
+        ret = permit_digest_fd (fd, algo, digest);
+        if (ret != 0 || stbuf->st_ctim.tv_sec >= now)
+                return ret;
+
+        digcache_put (stbuf, algo, digest);
+
+        return 0;
+}
+
+
+#ifdef LE_WRITEDIGEST
+/* the slot following @fd, locked, or NULL */
+static struct wdigest *
+wdigest_get (int fd)
+{
+        struct wdigest *wd = NULL;
+        int             i = 0;
+
+        if (!__atomic_load_n (&wdigests.active, __ATOMIC_ACQUIRE))
+                return NULL;
+
+        for (i = 0; i < WDIGEST_ENTS; i++) {
+                wd = &wdigests.ents[i];
+                if (__atomic_load_n (&wd->fd, __ATOMIC_RELAXED) != fd)
+                        continue;
+
+                pthread_mutex_lock (&wd->lock);
+                if (wd->fd == fd)
+                        return wd;
+                pthread_mutex_unlock (&wd->lock);
+        }
+
+        return NULL;
+}
+
+
+static void
+wdigest_put (struct wdigest *wd)
+{
+        pthread_mutex_unlock (&wd->lock);
+}
+
+
+static void
+wdigest_kill (struct wdigest *wd)
+{
+        if (!wd->live)
+                return;
+
+        wd->live = NO;
+        __atomic_add_fetch (&wdigests.dropped, 1, __ATOMIC_RELAXED);
+}
+
+
+/* unlocks and frees the slot */
+static void
+wdigest_free (struct wdigest *wd)
+{
+        __atomic_store_n (&wd->fd, -1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock (&wd->lock);
+        __atomic_sub_fetch (&wdigests.active, 1, __ATOMIC_RELEASE);
+}
+
+
+/* @n bytes of @buf just written at @off */
+static void
+wdigest_fold (struct wdigest *wd, off_t off, const void *buf, size_t n)
+{
+        if (!wd->live)
+                return;
+
+        if (off != wd->len) {
+                wdigest_kill (wd);
+                return;
+        }
+
+        if (wd->algos & (1 << PERMIT_MD5))
+                md5_update (&wd->md5, buf, n);
+        if (wd->algos & (1 << PERMIT_SHA256))
+                sha_update (&wd->sha256, buf, n);
+        if (wd->algos & (1 << PERMIT_BLAKE3))
+                blake3_update (&wd->blake3, buf, n);
+
+        wd->len += n;
+}
+
+
+static void
+wdigest_forget (int fd)
+{
+        struct wdigest *wd = NULL;
+
+        wd = wdigest_get (fd);
+        if (wd)
+                wdigest_free (wd);
+}
+
+
+static void
+wdigest_drop (int fd)
+{
+        struct wdigest *wd = NULL;
+
+        wd = wdigest_get (fd);
+        if (!wd)
+                return;
+
+        wdigest_kill (wd);
+        wdigest_put (wd);
+}
+
+
+/* writes through either fd move the other's offset. @newfd may have
+   been following a file of its own until the dup closed it */
+static void
+wdigest_dup (int oldfd, int newfd)
+{
+        if (newfd == oldfd)
+                return;
+
+        wdigest_forget (newfd);
+        wdigest_drop (oldfd);
+}
+
+
+/* start following @fd, whose file this open created, if it could ever
+   be renamed over a protected entry. the digests kept are those the
+   permits are in now */
+static void
+wdigest_open (int fd, int flags)
+{
+        struct le_reader *self = NULL;
+        struct permtab   *tab = NULL;
+        struct wdigest   *wd = NULL;
+        struct stat       stbuf = {0, };
+        unsigned int      algos = 0;
+        int               unused = -1;
+        int               i = 0;
+
+        /* left behind by an fd closed where the traps did not see it */
+        wdigest_forget (fd);
+
+        if (!wdigests.ready || (flags & O_APPEND))
+                return;
+
+        if (le_statat (fd, "", AT_EMPTY_PATH, 0, &stbuf) != 0 ||
+            !S_ISREG (stbuf.st_mode) || !is_protected_dev (stbuf.st_dev))
+                return;
+
+        if (permits_load () != YES)
+                return;
+
+        self = reader_enter ();
+        {
+                tab = __atomic_load_n (&protect.permits, __ATOMIC_ACQUIRE);
+                algos = tab->algos;
+        }
+        reader_exit (self);
+
+        if (!algos)
+                return;
+
+        for (i = 0; i < WDIGEST_ENTS; i++) {
+                wd = &wdigests.ents[i];
+                unused = -1;
+                if (__atomic_compare_exchange_n (&wd->fd, &unused, -2, NO,
+                                                 __ATOMIC_ACQUIRE,
+                                                 __ATOMIC_RELAXED))
+                        break;
+        }
+
+        if (i == WDIGEST_ENTS)
+                return;
+
+        pthread_mutex_lock (&wd->lock);
+        {
+                wd->live = YES;
+                wd->dev = stbuf.st_dev;
+                wd->ino = stbuf.st_ino;
+                wd->pos = 0;
+                wd->len = 0;
+                wd->algos = algos;
+                if (algos & (1 << PERMIT_MD5))
+                        md5_begin (&wd->md5);
+                if (algos & (1 << PERMIT_SHA256))
+                        sha_begin (&wd->sha256, SHA_256);
+                if (algos & (1 << PERMIT_BLAKE3))
+                        blake3_begin (&wd->blake3, 0);
+                __atomic_store_n (&wd->fd, fd, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock (&wd->lock);
+
+        __atomic_add_fetch (&wdigests.active, 1, __ATOMIC_RELEASE);
+}
+
+
+/* on the way to closing @fd: if every byte of its file was digested,
+   hand the digests to digcache under the file as it is now, where the
+   rename check will look them up. that skips the check against the
+   current second permit_digest makes: the writes themselves were seen,
+   not read back from whatever the file held at the time */
+static void
+wdigest_close (int fd)
+{
+        struct wdigest *wd = NULL;
+        struct stat     stbuf = {0, };
+        unsigned char   digest[PERMIT_ALGOS][PERMIT_DIGEST_MAX];
+        unsigned int    algos = 0;
+        int             algo = 0;
+
+        wd = wdigest_get (fd);
+        if (!wd)
+                return;
+
+        /* nothing unseen grew or shrank it, and nobody but the owner
+           could have opened it for writing */
+        if (wd->live && fstat (fd, &stbuf) == 0 &&
+            stbuf.st_dev == wd->dev && stbuf.st_ino == wd->ino &&
+            stbuf.st_size == wd->len &&
+            !(stbuf.st_mode & (S_IWGRP | S_IWOTH))) {
+                algos = wd->algos;
+                if (algos & (1 << PERMIT_MD5))
+                        md5_result (&wd->md5, digest[PERMIT_MD5]);
+                if (algos & (1 << PERMIT_SHA256))
+                        sha_result (&wd->sha256, digest[PERMIT_SHA256]);
+                if (algos & (1 << PERMIT_BLAKE3))
+                        blake3_result (&wd->blake3, digest[PERMIT_BLAKE3]);
+        } else {
+                wdigest_kill (wd);
+        }
+
+        wdigest_free (wd);
+
+        if (!algos)
+                return;
+
+        for (algo = 0; algo < PERMIT_ALGOS; algo++) {
+                if (algos & (1 << algo))
+                        digcache_put (&stbuf, algo, digest[algo]);
+        }
+        __atomic_add_fetch (&wdigests.kept, 1, __ATOMIC_RELAXED);
+}
+#else
+static void
+wdigest_open (int fd, int flags)
+{
+}
+
+
+static void
+wdigest_close (int fd)
+{
+}
+
+
+static void
+wdigest_forget (int fd)
+{
+}
+
+
+static void
+wdigest_dup (int oldfd, int newfd)
+{
+}
+#endif
+
+
+/* whether a file with this digest may replace the entry dst. the path
+   is looked up again only if dst is not the inode the table saw there,
+   unchanged */
+static int
+permits_match (const struct permtab *tab, int algo,
+               const unsigned char *digest, const struct stat *dst)
+{
+        const struct permit_entry *entry = NULL;
+        struct stat                stbuf = {0, };
+        unsigned int               i = 0;
+
+        for (i = permtab_hash (algo, digest) & tab->mask; tab->ents[i].path;
+             i = (i + 1) & tab->mask) {
+                entry = &tab->ents[i];
+                if (entry->algo != algo ||
+                    memcmp (entry->digest, digest, permit_algos[algo].len))
+                        continue;
+
+                dbg ("permitted: %s\n", entry->path);
+
+                if (entry->ino == dst->st_ino && entry->dev == dst->st_dev &&
+                    entry->ctime.tv_sec == dst->st_ctim.tv_sec &&
+                    entry->ctime.tv_nsec == dst->st_ctim.tv_nsec)
+                        return YES;
+
+                if (lstat (entry->path, &stbuf) != 0) {
+                        dbg ("%s: %s\n", entry->path, strerror (errno));
+                        continue;
+                }
+
+                dbg ("cmp p_i=%llu,p_d=%llu a_i=%llu,a_d=%llu\n",
+                     (unsigned long long) (stbuf.st_ino),
+                     (unsigned long long) (stbuf.st_dev),
+                     (unsigned long long) (dst->st_ino),
+                     (unsigned long long) (dst->st_dev));
+
+                if (stbuf.st_ino == dst->st_ino && stbuf.st_dev == dst->st_dev)
+                        return YES;
+        }
+
+        return NO;
+}
+
+
+/* what one rename decision has learnt so far about its two names, so
+   that each is resolved only once per call, but for the destination's
+   ctime when permits are matched. a stat with st_ino == 0 was never
+   taken.
+*/
+struct rename_ctx {
+        int             olddirfd;
+        const char     *oldpath;
+        int             newdirfd;
+        const char     *newpath;
+        struct stat     src;
+        struct stat     dst;
+};
+
+
+static int
+is_permitted_renameat (struct rename_ctx *ctx)
+{
+        struct le_reader *self = NULL;
+        struct stat       fdstat = {0, };
+        struct permtab   *tab = NULL;
+        unsigned char     digest[PERMIT_ALGOS][PERMIT_DIGEST_MAX];
+        unsigned int      algos = 0;
+        time_t            now = 0;
+        int               algo = 0;
+        int               fd = -1;
+        int               ret = 0;
+
+
+        /* again, for the ctime permits_match checks the identity by */
+        ret = le_statat (ctx->newdirfd, ctx->newpath, AT_SYMLINK_NOFOLLOW,
+                         STATX_CTIME, &ctx->dst);
+        if (ret != 0)
+                return NO;
+
+        if (ctx->src.st_ino && !S_ISREG (ctx->src.st_mode))
+                return NO;
+
+        /* without permits there is nothing to hash the source for */
+        ret = permits_load ();
+        if (ret != YES)
+                return NO;
+
+        /* O_NONBLOCK: a fifo must not hang us before it is refused */
+        fd = openat (ctx->olddirfd, ctx->oldpath,
+                     O_RDONLY|O_NOFOLLOW|O_NONBLOCK|O_CLOEXEC);
+        if (fd < 0)
+                return NO;
+
+        /* the open file, not the name: it is what gets hashed, and what
+           the digest cache knows it by */
+        now = time (NULL);
+        ret = fstat (fd, &fdstat);
+        if (ret != 0 || !S_ISREG (fdstat.st_mode)) {
+                close (fd);
+                return NO;
+        }
+
+        self = reader_enter ();
+        {
+                tab = __atomic_load_n (&protect.permits, __ATOMIC_ACQUIRE);
+                algos = tab->algos;
+        }
+        reader_exit (self);
+
+        /* usually one digest: the strongest the permits were made with */
+        for (algo = 0; algo < PERMIT_ALGOS; algo++) {
+                if (!(algos & (1 << algo)))
+                        continue;
+                ret = permit_digest (fd, &fdstat, now, algo, digest[algo]);
+                if (ret != 0)
+                        algos &= ~(1 << algo);
+        }
+        close (fd);
+
+        ret = NO;
+        self = reader_enter ();
+        {
+                tab = __atomic_load_n (&protect.permits, __ATOMIC_ACQUIRE);
+                for (algo = 0; algo < PERMIT_ALGOS && ret != YES; algo++) {
+                        if (algos & (1 << algo))
+                                ret = permits_match (tab, algo, digest[algo],
+                                                     &ctx->dst);
+                }
+        }
+        reader_exit (self);
+
+        return ret;
+}
+
+
+static int
+rename_allowed (int olddirfd, const char *oldpath,
+                int newdirfd, const char *newpath)
+{
+        struct rename_ctx ctx = {
+                .olddirfd = olddirfd,
+                .oldpath  = oldpath,
+                .newdirfd = newdirfd,
+                .newpath  = newpath,
+        };
+
+        if (is_protected_dirent (olddirfd, oldpath, &ctx.src))
+                return NO;
+
+        if (!is_protected_dirent (newdirfd, newpath, &ctx.dst))
+                return YES;
+
+        return is_permitted_renameat (&ctx);
+}
+
+
+int
+TRAP (rename, (const char *oldpath, const char *newpath))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                goto green;
+
+        if (!rename_allowed (AT_FDCWD, oldpath, AT_FDCWD, newpath))
+                goto red;
+green:
+        ret = REAL (rename) (oldpath, newpath);
+
+        return ret;
+
+red:
+        errno = EPERM;
+        return -1;
+}
+
+
+int
+TRAP (renameat, (int olddirfd, const char *oldpath,
+                 int newdirfd, const char *newpath))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                goto green;
+
+        if (!rename_allowed (olddirfd, oldpath, newdirfd, newpath))
+                goto red;
+
+green:
+        ret = REAL (renameat) (olddirfd, oldpath,
+                             newdirfd, newpath);
+        return ret;
+
+red:
+        errno = EPERM;
+        return -1;
+}
+
+
+int
+TRAP (unlink, (const char *pathname))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                goto green;
+
+        if (is_protected_entry (pathname))
+                goto red;
+
+green:
+        ret = REAL (unlink) (pathname);
+
+        return ret;
+
+red:
+        errno = EPERM;
+        return -1;
+}
+
+
+int
+TRAP (unlinkat, (int dirfd, const const char *pathname, int flags))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                goto green;
+
+        if (is_protected_dirent (dirfd, pathname, NULL))
+                goto red;
+
+green:
+        ret = REAL (unlinkat) (dirfd, pathname, flags);
+
+        return ret;
+
+red:
+        errno = EPERM;
+        return -1;
+}
+
+
+int
+TRAP (remove, (const char *pathname))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                goto green;
+
+        if (is_protected_entry (pathname))
+                goto red;
+
+green:
+        ret = REAL (remove) (pathname);
+
+        return ret;
+
+red:
+        errno = EPERM;
+        return -1;
+}
+
+
+int
+TRAP (truncate, (const char *path, off_t length))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                goto green;
+
+        if (is_protected_file (path))
+                goto red;
+
+green:
+        ret = REAL (truncate) (path, length);
+
+        return ret;
+
+red:
+        errno = EPERM;
+        return -1;
+}
+
+
+int
+TRAP (truncate64, (const char *path, off_t length))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                goto green;
+
+        if (is_protected_file (path))
+                goto red;
+
+green:
+        ret = REAL (truncate64) (path, length);
+
+        return ret;
+
+red:
+        errno = EPERM;
+        return -1;
+}
+
+
+static int open_checked (int dirfd, const char *path, int flags,
+                         mode_t mode);
+
+
+int
+TRAP (open, (const char *path, int flags, mode_t mode))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                return REAL (open) (path, flags, mode);
+
+        if ((flags & O_ACCMODE) == O_RDONLY) {
+                if (!(flags & O_TRUNC))
+                        goto green;
+                if (is_protected_file (path))
+                        goto red;
+                goto green;
+        }
+
+        return open_checked (AT_FDCWD, path, flags, mode);
+
+green:
+        ret = REAL (open) (path, flags, mode);
+        if (ret >= 0)
+                fdtable_forget (ret);
+
+        return ret;
+
+red:
+        errno = EPERM;
+        return -1;
+}
+
+
+int
+TRAP (openat, (int dirfd, const char *path, int flags, mode_t mode))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                return REAL (openat) (dirfd, path, flags, mode);
+
+        if ((flags & O_ACCMODE) == O_RDONLY) {
+                if (!(flags & O_TRUNC))
+                        goto green;
+                if (is_protected_atfile (dirfd, path))
+                        goto red;
+                goto green;
+        }
+
+        return open_checked (dirfd, path, flags, mode);
+
+green:
+        ret = REAL (openat) (dirfd, path, flags, mode);
+        if (ret >= 0)
+                fdtable_forget (ret);
+
+        return ret;
+
+red:
+        errno = EPERM;
+        return -1;
+}
+
+
+#if defined (LE_SIGCACHE) || defined (LE_SHAREDDEADLINE)
+/* for the shim's own files under LICDIR, which the trap would refuse */
+static int
+le_openat (int dirfd, const char *path, int flags, mode_t mode)
+{
+#ifndef LE_STATIC
+        return REAL (openat) (dirfd, path, flags, mode);
+#else
+        return openat (dirfd, path, flags, mode);
+#endif
+}
+#endif
+
+
+/* open_checked without /proc: open, then decide on the inode we
+   actually got. O_TRUNC is held back until it is known not to be
+   protected.
+*/
+static int
+open_checked_path (int dirfd, const char *path, int flags, mode_t mode,
+                   unsigned int gen)
+{
+        int         fd = -1;
+        int         ret = 0;
+        int         saved_errno = 0;
+        int         class = 0;
+        struct stat stbuf = {0, };
+
+        fd = REAL (openat) (dirfd, path, flags & ~O_TRUNC, mode);
+        if (fd < 0)
+                return fd;
+
+        ret = le_statat (fd, "", AT_EMPTY_PATH, 0, &stbuf);
+        if (ret != 0)
+                goto err;
+
+        class = fdtable_class (&stbuf);
+        if (class & FD_PROTECTED) {
+                errno = EPERM;
+                goto err;
+        }
+
+        fdtable_set (fd, class, gen);
+
+        if ((flags & O_TRUNC) && S_ISREG (stbuf.st_mode)) {
+                ret = ftruncate (fd, 0);
+                if (ret != 0)
+                        goto err;
+        }
+
+        return fd;
+err:
+        saved_errno = errno;
+        close (fd);
+        errno = saved_errno;
+
+        return -1;
+}
+
+
+/* decide on the inode the path leads to before it is opened for
+   writing, so that a protected one never is: an O_PATH open walks the
+   path once, and the real open goes through /proc/self/fd to that very
+   inode. an inode created by this very open cannot be protected, so
+   O_CREAT first tries O_EXCL. without /proc, or when O_CREAT is to
+   create the target of a dangling symlink, the path is opened again
+   and the inode it gives checked afterwards.
+*/
+static int
+open_checked (int dirfd, const char *path, int flags, mode_t mode)
+{
+        int          fd = -1;
+        int          pfd = -1;
+        int          ret = 0;
+        int          saved_errno = 0;
+        int          class = 0;
+        unsigned int gen = 0;
+        struct stat  stbuf = {0, };
+        char         procpath[64];
+
+        gen = __atomic_load_n (&protect.gen, __ATOMIC_ACQUIRE);
+
+        if ((flags & O_TMPFILE) == O_TMPFILE) {
+                fd = REAL (openat) (dirfd, path, flags, mode);
+                if (fd >= 0)
+                        fdtable_set (fd, FD_KNOWN, gen);
+                return fd;
+        }
+
+        if (flags & O_CREAT) {
+                fd = REAL (openat) (dirfd, path, flags | O_EXCL, mode);
+                if (fd >= 0) {
+                        fdtable_set (fd, FD_KNOWN, gen);
+                        wdigest_open (fd, flags);
+                }
+                if (fd >= 0 || errno != EEXIST || (flags & O_EXCL))
+                        return fd;
+        }
+
+        pfd = REAL (openat) (dirfd, path, O_PATH | O_CLOEXEC |
+                             (flags & (O_NOFOLLOW | O_DIRECTORY)), 0);
+        if (pfd < 0) {
+                if (errno == ENOENT && (flags & O_CREAT))
+                        return open_checked_path (dirfd, path, flags, mode,
+                                                  gen);
+                return -1;
+        }
+
+        ret = le_statat (pfd, "", AT_EMPTY_PATH, 0, &stbuf);
+        if (ret != 0)
+                goto err;
+
+        class = fdtable_class (&stbuf);
+        if (class & FD_PROTECTED) {
+                errno = EPERM;
+                goto err;
+        }
+
+        /* what O_NOFOLLOW would have refused */
+        if (S_ISLNK (stbuf.st_mode)) {
+                errno = ELOOP;
+                goto err;
+        }
+
+        snprintf (procpath, sizeof (procpath), "/proc/self/fd/%d", pfd);
+
+        fd = REAL (openat) (AT_FDCWD, procpath,
+                            flags & ~(O_CREAT | O_EXCL | O_NOFOLLOW), mode);
+        if (fd < 0 && errno == ENOENT && access ("/proc/self/fd", F_OK) != 0) {
+                close (pfd);
+                return open_checked_path (dirfd, path, flags, mode, gen);
+        }
+        if (fd < 0)
+                goto err;
+
+        close (pfd);
+
+        fdtable_set (fd, class, gen);
+
+        return fd;
+err:
+        saved_errno = errno;
+        close (pfd);
+        errno = saved_errno;
+
+        return -1;
+}
+
+
+int
+TRAP (creat, (const char *path, mode_t mode))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                goto green;
+
+        return open_checked (AT_FDCWD, path, O_CREAT|O_WRONLY|O_TRUNC, mode);
+
+green:
+        ret = REAL (creat) (path, mode);
+
+        return ret;
+}
+
+
+int
+TRAP (close, (int fd))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                return REAL (close) (fd);
+
+        wdigest_close (fd);
+
+        ret = REAL (close) (fd);
+
+        fdtable_forget (fd);
+
+        return ret;
+}
+
+
+int
+TRAP (fclose, (FILE *fp))
+{
+        int ret = 0;
+        int fd = -1;
+
+        if (is_licensed_prog ())
+                return REAL (fclose) (fp);
+
+        fd = fileno (fp);
+
+        /* flushed behind the traps */
+        wdigest_forget (fd);
+
+        ret = REAL (fclose) (fp);
+
+        fdtable_forget (fd);
+
+        return ret;
+}
+
+
+#ifdef HAVE_CLOSE_RANGE
+int
+TRAP (close_range, (unsigned int first, unsigned int last, int flags))
+{
+        int ret = 0;
+
+        if (is_licensed_prog ())
+                return REAL (close_range) (first, last, flags);
 
-        permitfile = getenv ("LE_PERMIT");
-        if (!permitfile)
-                permitfile = PERMITFILE;
+        ret = REAL (close_range) (first, last, flags);
 
-        ret = stat (permitfile, &stbuf);
-        /* don't care if it is symlink */
-        if (ret != 0) {
-                dbg ("%s: %s\n", permitfile, strerror (errno));
-                return NO;
-        }
+        /* CLOEXEC only marks them, and exec starts afresh anyway */
+        if (ret == 0 && !(flags & CLOSE_RANGE_CLOEXEC))
+                fdtable_forget_range (first, last);
 
-        if (!S_ISREG (stbuf.st_mode)) {
-                dbg ("%s: Not a regular file\n", permitfile);
-                return NO;
-        }
+        return ret;
+}
+#endif
 
-        permitfp = fopen (permitfile, "r");
-        if (!permitfp) {
-                dbg ("%s: %s\n", permitfile, strerror (errno));
-                return NO;
-        }
 
-        ret = is_signed_file (permitfile);
-        /* TODO: provide is_signed_fd which uses is_signed_file with
-           /proc/getpid()/fd/%d as filename
-        */
-        if (ret != YES) {
-                dbg ("%s: signature check failed\n", permitfile);
-                fclose (permitfp);
-                return NO;
+#ifdef HAVE_CLOSEFROM
+void
+TRAP_AS (void, closefrom, (int lowfd))
+{
+        if (is_licensed_prog ()) {
+                REAL (closefrom) (lowfd);
+                return;
         }
 
-        ret = permits_parse (permitfp);
-        fclose (permitfp);
+        REAL (closefrom) (lowfd);
 
-        return ret;
+        if (lowfd >= 0)
+                fdtable_forget_range (lowfd, ~0U);
 }
+#endif
 
 
-const char *
-get_permitted_path (unsigned char md5sum[16])
+/* libc opens these without going through the open traps, and may hand
+   out the number of an fd closed behind our back */
+FILE *
+TRAP_AS (FILE *, fopen, (const char *path, const char *mode))
 {
-        struct  permit_entry *entry = NULL;
+        FILE *ret = NULL;
 
-        for (entry = protect.permits; entry; entry = entry->next) {
-                if (memcmp (md5sum, entry->md5sum, 16) == 0)
-                        return entry->path;
-        }
+        ret = REAL (fopen) (path, mode);
 
-        return NULL;
+        if (ret && !is_licensed_prog ())
+                fdtable_forget (fileno (ret));
+
+        return ret;
 }
 
 
-static int
-is_permitted_renameat (int olddirfd, const char *oldpath,
-                       int newdirfd, const char *newpath)
+FILE *
+TRAP_AS (FILE *, fopen64, (const char *path, const char *mode))
 {
-        struct stat     attempted_dst_stat = {0,};
-        struct stat     permitted_dst_stat = {0,};
-        struct stat     src_stat = {0, };
-        int             ret = 0;
-        unsigned char   md5sum[16];
-        const char     *permitted_path = NULL;
+        FILE *ret = NULL;
 
+        ret = REAL (fopen64) (path, mode);
 
-        ret = fstatat (newdirfd, newpath, &attempted_dst_stat,
-                       AT_SYMLINK_NOFOLLOW);
-        if (ret != 0)
-                return NO;
+        if (ret && !is_licensed_prog ())
+                fdtable_forget (fileno (ret));
 
-        ret = fstatat (olddirfd, oldpath, &src_stat,
-                       AT_SYMLINK_NOFOLLOW);
-        if (ret != 0)
-                return NO;
+        return ret;
+}
 
-        if (!S_ISREG (src_stat.st_mode))
-                return NO;
 
-        ret = libevil_md5sum_file (olddirfd, oldpath, md5sum);
-        if (ret != 0)
-                return NO;
+FILE *
+TRAP_AS (FILE *, freopen, (const char *path, const char *mode, FILE *fp))
+{
+        FILE *ret = NULL;
 
-        ret = permits_load ();
-        if (ret != YES)
-                return NO;
+        ret = REAL (freopen) (path, mode, fp);
 
-        permitted_path = get_permitted_path (md5sum);
-        if (!permitted_path)
-                return NO;
+        if (ret && !is_licensed_prog ())
+                fdtable_forget (fileno (ret));
+
+        return ret;
+}
 
-        dbg ("permitted: %s\n", permitted_path);
 
-        ret = lstat (permitted_path, &permitted_dst_stat);
-        if (ret != 0) {
-                dbg ("%s: %s\n", permitted_path, strerror (errno));
-                return NO;
-        }
+FILE *
+TRAP_AS (FILE *, freopen64, (const char *path, const char *mode, FILE *fp))
+{
+        FILE *ret = NULL;
 
-        dbg ("cmp p_i=%llu,p_d=%llu a_i=%llu,a_d=%llu\n",
-             (unsigned long long) (permitted_dst_stat.st_ino),
-             (unsigned long long) (permitted_dst_stat.st_dev),
-             (unsigned long long) (attempted_dst_stat.st_ino),
-             (unsigned long long) (attempted_dst_stat.st_dev));
+        ret = REAL (freopen64) (path, mode, fp);
 
-        if (permitted_dst_stat.st_ino == attempted_dst_stat.st_ino &&
-            permitted_dst_stat.st_dev == attempted_dst_stat.st_dev)
-                return YES;
+        if (ret && !is_licensed_prog ())
+                fdtable_forget (fileno (ret));
 
-        return NO;
+        return ret;
 }
 
 
-static int
-is_permitted_rename (const char *oldpath, const char *newpath)
+DIR *
+TRAP_AS (DIR *, opendir, (const char *path))
 {
-        return is_permitted_renameat (AT_FDCWD, oldpath, AT_FDCWD, newpath);
+        DIR *ret = NULL;
+
+        ret = REAL (opendir) (path);
+
+        if (ret && !is_licensed_prog ())
+                fdtable_forget (dirfd (ret));
+
+        return ret;
 }
 
 
 int
-TRAP (rename, (const char *oldpath, const char *newpath))
+TRAP (closedir, (DIR *dir))
 {
         int ret = 0;
+        int fd = -1;
 
         if (is_licensed_prog ())
-                goto green;
+                return REAL (closedir) (dir);
 
-        if (is_protected_entry (oldpath))
-                goto red;
+        fd = dirfd (dir);
 
-        if (!is_protected_entry (newpath))
-                goto green;
+        ret = REAL (closedir) (dir);
 
-        if (!is_permitted_rename (oldpath, newpath))
-                goto red;
-green:
-        ret = real_rename (oldpath, newpath);
+        fdtable_forget (fd);
 
         return ret;
-
-red:
-        errno = EPERM;
-        return -1;
 }
 
 
 int
-TRAP (renameat, (int olddirfd, const char *oldpath,
-                 int newdirfd, const char *newpath))
+TRAP (dup, (int oldfd))
 {
         int ret = 0;
 
         if (is_licensed_prog ())
-                goto green;
-
-        if (is_protected_atentry (olddirfd, oldpath))
-                goto red;
+                return REAL (dup) (oldfd);
 
-        if (!is_protected_atentry (newdirfd, newpath))
-                goto green;
+        ret = REAL (dup) (oldfd);
 
-        if (!is_permitted_renameat (olddirfd, oldpath, newdirfd, newpath))
-                goto red;
+        if (ret >= 0) {
+                fdtable_dup (oldfd, ret);
+                wdigest_dup (oldfd, ret);
+        }
 
-green:
-        ret = real_renameat (olddirfd, oldpath,
-                             newdirfd, newpath);
         return ret;
-
-red:
-        errno = EPERM;
-        return -1;
 }
 
 
 int
-TRAP (unlink, (const char *pathname))
+TRAP (dup2, (int oldfd, int newfd))
 {
         int ret = 0;
 
         if (is_licensed_prog ())
-                goto green;
+                return REAL (dup2) (oldfd, newfd);
 
-        if (is_protected_entry (pathname))
-                goto red;
+        ret = REAL (dup2) (oldfd, newfd);
 
-green:
-        ret = real_unlink (pathname);
+        if (ret >= 0) {
+                fdtable_dup (oldfd, ret);
+                wdigest_dup (oldfd, ret);
+        }
 
         return ret;
-
-red:
-        errno = EPERM;
-        return -1;
 }
 
 
 int
-TRAP (unlinkat, (int dirfd, const const char *pathname, int flags))
+TRAP (dup3, (int oldfd, int newfd, int flags))
 {
         int ret = 0;
 
         if (is_licensed_prog ())
-                goto green;
+                return REAL (dup3) (oldfd, newfd, flags);
 
-        if (is_protected_atentry (dirfd, pathname))
-                goto red;
+        ret = REAL (dup3) (oldfd, newfd, flags);
 
-green:
-        ret = real_unlinkat (dirfd, pathname, flags);
+        if (ret >= 0) {
+                fdtable_dup (oldfd, ret);
+                wdigest_dup (oldfd, ret);
+        }
 
         return ret;
+}
 
-red:
-        errno = EPERM;
-        return -1;
+
+/* fcntl and fcntl64 (what glibc 2.28 and later link against) */
+static void
+fcntl_done (int fd, int cmd, int ret)
+{
+        if (ret >= 0 && (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC)) {
+                fdtable_dup (fd, ret);
+                wdigest_dup (fd, ret);
+        }
 }
 
 
 int
-TRAP (remove, (const char *pathname))
+TRAP (fcntl, (int fd, int cmd, ...))
 {
-        int ret = 0;
+        int      ret = 0;
+        void    *arg = NULL;
+        va_list  ap;
+
+        va_start (ap, cmd);
+        arg = va_arg (ap, void *);
+        va_end (ap);
 
         if (is_licensed_prog ())
-                goto green;
+                return REAL (fcntl) (fd, cmd, arg);
 
-        if (is_protected_entry (pathname))
-                goto red;
+        ret = REAL (fcntl) (fd, cmd, arg);
 
-green:
-        ret = real_remove (pathname);
+        fcntl_done (fd, cmd, ret);
 
         return ret;
-
-red:
-        errno = EPERM;
-        return -1;
 }
 
 
 int
-TRAP (truncate, (const char *path, off_t length))
+TRAP (fcntl64, (int fd, int cmd, ...))
 {
-        int ret = 0;
+        int      ret = 0;
+        void    *arg = NULL;
+        va_list  ap;
+
+        va_start (ap, cmd);
+        arg = va_arg (ap, void *);
+        va_end (ap);
 
         if (is_licensed_prog ())
-                goto green;
+                return REAL (fcntl64) (fd, cmd, arg);
 
-        if (is_protected_file (path))
-                goto red;
+        ret = REAL (fcntl64) (fd, cmd, arg);
 
-green:
-        ret = real_truncate (path, length);
+        fcntl_done (fd, cmd, ret);
 
         return ret;
-
-red:
-        errno = EPERM;
-        return -1;
 }
 
 
-int
-TRAP (truncate64, (const char *path, off_t length))
+#ifdef LE_WRITEDIGEST
+ssize_t
+TRAP_AS (ssize_t, write, (int fd, const void *buf, size_t count))
 {
-        int ret = 0;
+        struct wdigest *wd = NULL;
+        ssize_t         ret = 0;
 
         if (is_licensed_prog ())
-                goto green;
+                return REAL (write) (fd, buf, count);
 
-        if (is_protected_file (path))
-                goto red;
+        wd = wdigest_get (fd);
+        if (!wd)
+                return REAL (write) (fd, buf, count);
 
-green:
-        ret = real_truncate64 (path, length);
+        ret = REAL (write) (fd, buf, count);
+        if (ret > 0) {
+                wdigest_fold (wd, wd->pos, buf, ret);
+                wd->pos += ret;
+        }
+        wdigest_put (wd);
 
         return ret;
-
-red:
-        errno = EPERM;
-        return -1;
 }
 
 
-int
-TRAP (open, (const char *path, int flags, mode_t mode))
+/* the build has a 64-bit off_t, but pwrite, lseek and mmap are the
+   calls of programs built without one: on a 32-bit host they take a
+   long, and only their *64 twins an off64_t */
+ssize_t
+TRAP_AS (ssize_t, pwrite, (int fd, const void *buf, size_t count,
+                           __off_t offset))
 {
-        int ret = 0;
+        struct wdigest *wd = NULL;
+        ssize_t         ret = 0;
 
         if (is_licensed_prog ())
-                goto green;
-
-        if (!is_protected_file (path))
-                goto green;
+                return REAL (pwrite) (fd, buf, count, offset);
 
-        if ((flags & O_ACCMODE) != O_RDONLY)
-                goto red;
+        wd = wdigest_get (fd);
+        if (!wd)
+                return REAL (pwrite) (fd, buf, count, offset);
 
-green:
-        ret = real_open (path, flags, mode);
+        ret = REAL (pwrite) (fd, buf, count, offset);
+        if (ret > 0)
+                wdigest_fold (wd, offset, buf, ret);
+        wdigest_put (wd);
 
         return ret;
-
-red:
-        errno = EPERM;
-        return -1;
 }
 
 
-int
-TRAP (openat, (int dirfd, const char *path, int flags, mode_t mode))
+ssize_t
+TRAP_AS (ssize_t, pwrite64, (int fd, const void *buf, size_t count,
+                             off64_t offset))
 {
-        int ret = 0;
+        struct wdigest *wd = NULL;
+        ssize_t         ret = 0;
 
         if (is_licensed_prog ())
-                goto green;
-
-        if (!is_protected_atfile (dirfd, path))
-                goto green;
+                return REAL (pwrite64) (fd, buf, count, offset);
 
-        if ((flags & O_ACCMODE) != O_RDONLY)
-                goto red;
+        wd = wdigest_get (fd);
+        if (!wd)
+                return REAL (pwrite64) (fd, buf, count, offset);
 
-green:
-        ret = real_openat (dirfd, path, flags, mode);
+        ret = REAL (pwrite64) (fd, buf, count, offset);
+        if (ret > 0)
+                wdigest_fold (wd, offset, buf, ret);
+        wdigest_put (wd);
 
         return ret;
+}
 
-red:
-        errno = EPERM;
-        return -1;
+
+/* going back would have the next write rewrite what was digested.
+   going forward leaves a hole, which the next write notices */
+__off_t
+TRAP_AS (__off_t, lseek, (int fd, __off_t offset, int whence))
+{
+        struct wdigest *wd = NULL;
+        __off_t         ret = 0;
+
+        if (is_licensed_prog ())
+                return REAL (lseek) (fd, offset, whence);
+
+        wd = wdigest_get (fd);
+        if (!wd)
+                return REAL (lseek) (fd, offset, whence);
+
+        ret = REAL (lseek) (fd, offset, whence);
+        if (ret >= 0) {
+                wd->pos = ret;
+                if (ret < wd->len)
+                        wdigest_kill (wd);
+        }
+        wdigest_put (wd);
+
+        return ret;
 }
 
 
-int
-TRAP (creat, (const char *path, mode_t mode))
+off64_t
+TRAP_AS (off64_t, lseek64, (int fd, off64_t offset, int whence))
 {
-        int ret = 0;
+        struct wdigest *wd = NULL;
+        off64_t         ret = 0;
 
         if (is_licensed_prog ())
-                goto green;
+                return REAL (lseek64) (fd, offset, whence);
 
-        if (is_protected_file (path))
-                goto red;
+        wd = wdigest_get (fd);
+        if (!wd)
+                return REAL (lseek64) (fd, offset, whence);
 
-green:
-        ret = real_creat (path, mode);
+        ret = REAL (lseek64) (fd, offset, whence);
+        if (ret >= 0) {
+                wd->pos = ret;
+                if (ret < wd->len)
+                        wdigest_kill (wd);
+        }
+        wdigest_put (wd);
 
         return ret;
+}
 
-red:
-        errno = EPERM;
-        return -1;
+
+/* stores through a shared mapping are never seen, and go on after the
+   fd is closed. a read-only one can still be mprotect()ed writable */
+void *
+TRAP_AS (void *, mmap, (void *addr, size_t length, int prot, int flags,
+                        int fd, __off_t offset))
+{
+        void *ret = NULL;
+
+        ret = REAL (mmap) (addr, length, prot, flags, fd, offset);
+
+        if (ret != MAP_FAILED && (flags & MAP_TYPE) != MAP_PRIVATE)
+                wdigest_drop (fd);
+
+        return ret;
+}
+
+
+void *
+TRAP_AS (void *, mmap64, (void *addr, size_t length, int prot, int flags,
+                          int fd, off64_t offset))
+{
+        void *ret = NULL;
+
+        ret = REAL (mmap64) (addr, length, prot, flags, fd, offset);
+
+        if (ret != MAP_FAILED && (flags & MAP_TYPE) != MAP_PRIVATE)
+                wdigest_drop (fd);
+
+        return ret;
 }
+#endif
 
 
 int
@@ -1139,7 +4537,7 @@ TRAP (chmod, (const char *path, mode_t mode))
                 goto red;
 
 green:
-        ret = real_chmod (path, mode);
+        ret = REAL (chmod) (path, mode);
 
         return ret;
 
@@ -1161,7 +4559,7 @@ TRAP (fchmod, (int fd, mode_t mode))
                 goto red;
 
 green:
-        ret = real_fchmod (fd, mode);
+        ret = REAL (fchmod) (fd, mode);
 
         return ret;
 
@@ -1188,7 +4586,7 @@ TRAP (fchmodat, (int dirfd, const char *path, mode_t mode, int flags))
         }
 
 green:
-        ret = real_fchmodat (dirfd, path, mode, flags);
+        ret = REAL (fchmodat) (dirfd, path, mode, flags);
 
         return ret;
 
@@ -1210,7 +4608,7 @@ TRAP (chown, (const char *path, uid_t uid, gid_t gid))
                 goto red;
 
 green:
-        ret = real_chown (path, uid, gid);
+        ret = REAL (chown) (path, uid, gid);
 
         return ret;
 
@@ -1232,7 +4630,7 @@ TRAP (lchown, (const char *path, uid_t uid, gid_t gid))
                 goto red;
 
 green:
-        ret = real_lchown (path, uid, gid);
+        ret = REAL (lchown) (path, uid, gid);
 
         return ret;
 
@@ -1254,7 +4652,7 @@ TRAP (fchown, (int fd, uid_t uid, gid_t gid))
                 goto red;
 
 green:
-        ret = real_fchown (fd, uid, gid);
+        ret = REAL (fchown) (fd, uid, gid);
 
         return ret;
 
@@ -1281,7 +4679,7 @@ TRAP (fchownat, (int dirfd, const char *path, uid_t uid, gid_t gid, int flags))
         }
 
 green:
-        ret = real_fchownat (dirfd, path, uid, gid, flags);
+        ret = REAL (fchownat) (dirfd, path, uid, gid, flags);
 
         return ret;
 red:
@@ -1302,7 +4700,7 @@ TRAP (utime, (const char *filename, const struct utimbuf *times))
                 goto red;
 
 green:
-        ret = real_utime (filename, times);
+        ret = REAL (utime) (filename, times);
 
         return ret;
 red:
@@ -1323,7 +4721,7 @@ TRAP (utimes, (const char *filename, const struct timeval times[2]))
                 goto red;
 
 green:
-        ret = real_utimes (filename, times);
+        ret = REAL (utimes) (filename, times);
 
         return ret;
 red:
@@ -1349,7 +4747,7 @@ TRAP (utimensat, (int dirfd, const char *pathname,
                         goto red;
         }
 green:
-        ret = real_utimensat (dirfd, pathname, times, flags);
+        ret = REAL (utimensat) (dirfd, pathname, times, flags);
 
         return ret;
 red:
@@ -1371,7 +4769,7 @@ TRAP (futimesat, (int dirfd, const char *pathname,
                 goto red;
 
 green:
-        ret = real_futimesat (dirfd, pathname, times);
+        ret = REAL (futimesat) (dirfd, pathname, times);
 
         return ret;
 red:
@@ -1398,7 +4796,7 @@ TRAP (mount, (const char *source, const char *target,
         */
 
 green:
-        ret = real_mount (source, target, filesystemtype, mountflags, data);
+        ret = REAL (mount) (source, target, filesystemtype, mountflags, data);
 
         return ret;
 red:
@@ -1416,7 +4814,7 @@ TRAP (pivot_root, (const char *new_root, const char *old_put))
 #if 0
         int   ret = 0;
 
-        ret = real_pivot_root (new_root, old_put);
+        ret = REAL (pivot_root) (new_root, old_put);
 
         return ret;
 #endif
@@ -1428,7 +4826,7 @@ TRAP (chroot, (const char *path))
 {
         int   ret = 0;
 
-        ret = real_chroot (path);
+        ret = REAL (chroot) (path);
 
         return ret;
 }
@@ -1440,7 +4838,7 @@ TRAP (ptrace, (enum __ptrace_request request, pid_t pid,
 {
         int   ret = 0;
 
-        ret = real_ptrace (request, pid, addr, data);
+        ret = REAL (ptrace) (request, pid, addr, data);
 
         return ret;
 }
@@ -1452,7 +4850,7 @@ TRAP (execve, (const char *filename, const char *argv[], const char *envp[]))
         int   ret = 0;
 
         unsetenv ("LD_PRELOAD");
-        ret = real_execve (filename, argv, envp);
+        ret = REAL (execve) (filename, argv, envp);
 
         return ret;
 }
@@ -1465,7 +4863,7 @@ TRAP (epoll_create, (int flags))
 
         make_licensed_prog ();
 
-        ret = real_epoll_create (flags);
+        ret = REAL (epoll_create) (flags);
 
         return ret;
 }
@@ -1478,7 +4876,7 @@ TRAP (epoll_create1, (int flags))
 
         make_licensed_prog ();
 
-        ret = real_epoll_create1 (flags);
+        ret = REAL (epoll_create1) (flags);
 
         return ret;
 }
@@ -1544,6 +4942,7 @@ read:
 }
 
 
+#ifndef LE_STATIC
 static void libevil_init (void) __attribute__((constructor));
 
 
@@ -1554,8 +4953,87 @@ libevil_init (void)
 
         create_epoch ();
 
+        prepare_watch ();
+
+        detect_licensed_prog ();
+
+        /* a licensed program never checks anything, and stays licensed */
+        if (is_licensed_prog ())
+                return;
+
         prepare_glob ();
 
         return;
 }
+#else
+static pthread_once_t libevil_once = PTHREAD_ONCE_INIT;
+
+
+static void
+__libevil_init (void)
+{
+        dbg_init ();
+
+        create_epoch ();
+
+        prepare_glob ();
+
+        prepare_watch ();
+
+        /* linking us in is what makes a program licensed */
+        make_licensed_prog ();
+}
+
+
+void
+libevil_init (void)
+{
+        pthread_once (&libevil_once, __libevil_init);
+}
+
+
+time_t
+libevil_deadline (void)
+{
+        return watched_deadline (0);
+}
+
+
+int
+libevil_is_protected (int dirfd, const char *path, int follow)
+{
+        return __is_protected_atpath (dirfd, path, follow, NULL);
+}
+
+
+int
+libevil_is_protected_fd (int fd)
+{
+        return __is_protected_fd (fd);
+}
+
+
+int
+libevil_refuses_rename (int olddirfd, const char *oldpath,
+                        int newdirfd, const char *newpath)
+{
+        return rename_allowed (olddirfd, oldpath, newdirfd, newpath) ? NO : YES;
+}
+#endif
 
+
+#ifndef LE_STATIC
+static void libevil_fini (void) __attribute__((destructor));
+
+
+static void
+libevil_fini (void)
+{
+        dbg ("digest cache: hits=%lu misses=%lu\n",
+             digcache.hits, digcache.misses);
+#ifdef LE_WRITEDIGEST
+        dbg ("write digests: kept=%lu dropped=%lu\n",
+             wdigests.kept, wdigests.dropped);
+#endif
+}
+#endif
@@ -5,14 +5,37 @@
 
 #define __cons __attribute__((constructor))
 
-#define TRAP(func, params)                                              \
+/* TRAP_AS for calls returning something other than an int, whose
+   type is given again as the first argument */
+#ifndef LE_STATIC
+#define TRAP_AS(type, func, params)                                     \
         evil_##func params;                                             \
-        static int (*real_##func) params;                               \
+        static type (*real_##func) params __attribute__((used));        \
         static void set_real_##func (void) __cons;                      \
         static void set_real_##func (void)                              \
         { real_##func = dlsym (RTLD_NEXT, #func); }                     \
-        int __REDIRECT (evil_##func, params, func);                     \
-        int evil_##func params
+        type __REDIRECT (evil_##func, params, func);                    \
+        type evil_##func params
+
+/* another library's constructor can run before ours and already call
+   into a trap, so resolve the real one there if need be */
+#define REAL(func)                                                      \
+        (__builtin_expect (real_##func != NULL, 1) ? real_##func :       \
+         (set_real_##func (), real_##func))
+#else
+/* libevil.a interposes nothing: the traps are compiled, so that both
+   builds see the same code, but nothing can reach them.
+*/
+#define TRAP_AS(type, func, params)                                     \
+        evil_##func##_unused (void);                                    \
+        static type (*real_##func) params __attribute__((unused));      \
+        static type evil_##func params __attribute__((unused));         \
+        static type evil_##func params
+
+#define REAL(func) real_##func
+#endif
+
+#define TRAP(func, params) TRAP_AS (int, func, params)
 
 
 enum {
@@ -25,9 +48,27 @@ enum {
 #define LICDIR "/lic"
 #define PERMITFILE LICDIR "/permit.asc"
 #define LICFILE LICDIR "/license.asc"
+#define SIGCACHE_FILE LICDIR "/.sigcache"
+#define DEADLINE_FILE LICDIR "/.deadline"
 
 #define MAX(a,b) ( (a) > (b) ? (a) : (b) )
 
+#ifdef HAVE_SPINLOCK
+#define LOCK_INIT(x)    pthread_spin_init (x, 0)
+#define LOCK(x)         pthread_spin_lock (x)
+#define UNLOCK(x)       pthread_spin_unlock (x)
+#define LOCK_DESTROY(x) pthread_spin_destroy (x)
+
+typedef pthread_spinlock_t le_lock_t;
+#else
+#define LOCK_INIT(x)    pthread_mutex_init (x, 0)
+#define LOCK(x)         pthread_mutex_lock (x)
+#define UNLOCK(x)       pthread_mutex_unlock (x)
+#define LOCK_DESTROY(x) pthread_mutex_destroy (x)
+
+typedef pthread_mutex_t le_lock_t;
+#endif
+
 #define SECS(x) (x)
 #define MINS(x) (x * SECS(60))
 #define HOURS(x) (x * MINS(60))
@@ -41,6 +41,7 @@
 
 
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -49,10 +50,11 @@
 
 #undef CAREFUL_ALIGNMENT
 
-/* We know that the x86 can handle misalignment and has the same
- * byte order (LSB-first) as the 32-bit numbers we transmit. */
+/* Any little-endian cpu has the byte order (LSB-first) of the 32-bit
+ * numbers we transmit. The loads below go through memcpy, which the
+ * compiler turns into a single load wherever misalignment is legal. */
 
-#ifdef __i386__
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 #define CAREFUL_ALIGNMENT 0
 #endif
 
@@ -72,16 +74,21 @@
 #define SIVAL(buf,pos,val) SIVALX((buf),(pos),((uint32_t)(val)))
 #else
 
-/* this handles things for architectures like the 386 that can handle
-   alignment errors */
+static inline uint32_t le32_load(const void *p)
+{
+	uint32_t val;
 
-/*
-   WARNING: This section is dependent on the length of int32
-   being correct. set CAREFUL_ALIGNMENT if it is not.
-*/
+	memcpy(&val, p, sizeof val);
+	return val;
+}
+
+static inline void le32_store(void *p, uint32_t val)
+{
+	memcpy(p, &val, sizeof val);
+}
 
-#define IVAL(buf,pos) (*(uint32_t *)((char *)(buf) + (pos)))
-#define SIVAL(buf,pos,val) IVAL(buf,pos)=((uint32_t)(val))
+#define IVAL(buf,pos) le32_load((const char *)(buf) + (pos))
+#define SIVAL(buf,pos,val) le32_store((char *)(buf) + (pos), (uint32_t)(val))
 #endif
 
 /* The include file for both the MD4 and MD5 routines. */
@@ -114,116 +121,106 @@ static void md5_begin(md_context *ctx)
 	ctx->totalN = ctx->totalN2 = 0;
 }
 
+#define S(x,n) ((x << n) | ((x & 0xFFFFFFFF) >> (32 - n)))
+
+#define F1(x,y,z) (z ^ (x & (y ^ z)))
+#define F3(x,y,z) (x ^ y ^ z)
+#define F4(x,y,z) (y ^ (x | ~z))
+
+#define P(a,b,c,d,k,s,t,F) a += X[k] + t, a += F(b,c,d), a = S(a,s) + b
+
+#define P1(a,b,c,d,k,s,t) P(a,b,c,d,k,s,t,F1)
+/* G is (b & d) | (c & ~d) with the halves disjoint, so they are added
+   one by one: the half not needing b is summed while b is computed */
+#define P2(a,b,c,d,k,s,t) a += X[k] + t, a += (c & ~d), a += (b & d), \
+			  a = S(a,s) + b
+#define P3(a,b,c,d,k,s,t) P(a,b,c,d,k,s,t,F3)
+#define P4(a,b,c,d,k,s,t) P(a,b,c,d,k,s,t,F4)
+
+/* the 64 steps, on X[16] and A..D */
+#define MD5_STEPS \
+	P1(A, B, C, D,  0,  7, 0xD76AA478); \
+	P1(D, A, B, C,  1, 12, 0xE8C7B756); \
+	P1(C, D, A, B,  2, 17, 0x242070DB); \
+	P1(B, C, D, A,  3, 22, 0xC1BDCEEE); \
+	P1(A, B, C, D,  4,  7, 0xF57C0FAF); \
+	P1(D, A, B, C,  5, 12, 0x4787C62A); \
+	P1(C, D, A, B,  6, 17, 0xA8304613); \
+	P1(B, C, D, A,  7, 22, 0xFD469501); \
+	P1(A, B, C, D,  8,  7, 0x698098D8); \
+	P1(D, A, B, C,  9, 12, 0x8B44F7AF); \
+	P1(C, D, A, B, 10, 17, 0xFFFF5BB1); \
+	P1(B, C, D, A, 11, 22, 0x895CD7BE); \
+	P1(A, B, C, D, 12,  7, 0x6B901122); \
+	P1(D, A, B, C, 13, 12, 0xFD987193); \
+	P1(C, D, A, B, 14, 17, 0xA679438E); \
+	P1(B, C, D, A, 15, 22, 0x49B40821); \
+	\
+	P2(A, B, C, D,  1,  5, 0xF61E2562); \
+	P2(D, A, B, C,  6,  9, 0xC040B340); \
+	P2(C, D, A, B, 11, 14, 0x265E5A51); \
+	P2(B, C, D, A,  0, 20, 0xE9B6C7AA); \
+	P2(A, B, C, D,  5,  5, 0xD62F105D); \
+	P2(D, A, B, C, 10,  9, 0x02441453); \
+	P2(C, D, A, B, 15, 14, 0xD8A1E681); \
+	P2(B, C, D, A,  4, 20, 0xE7D3FBC8); \
+	P2(A, B, C, D,  9,  5, 0x21E1CDE6); \
+	P2(D, A, B, C, 14,  9, 0xC33707D6); \
+	P2(C, D, A, B,  3, 14, 0xF4D50D87); \
+	P2(B, C, D, A,  8, 20, 0x455A14ED); \
+	P2(A, B, C, D, 13,  5, 0xA9E3E905); \
+	P2(D, A, B, C,  2,  9, 0xFCEFA3F8); \
+	P2(C, D, A, B,  7, 14, 0x676F02D9); \
+	P2(B, C, D, A, 12, 20, 0x8D2A4C8A); \
+	\
+	P3(A, B, C, D,  5,  4, 0xFFFA3942); \
+	P3(D, A, B, C,  8, 11, 0x8771F681); \
+	P3(C, D, A, B, 11, 16, 0x6D9D6122); \
+	P3(B, C, D, A, 14, 23, 0xFDE5380C); \
+	P3(A, B, C, D,  1,  4, 0xA4BEEA44); \
+	P3(D, A, B, C,  4, 11, 0x4BDECFA9); \
+	P3(C, D, A, B,  7, 16, 0xF6BB4B60); \
+	P3(B, C, D, A, 10, 23, 0xBEBFBC70); \
+	P3(A, B, C, D, 13,  4, 0x289B7EC6); \
+	P3(D, A, B, C,  0, 11, 0xEAA127FA); \
+	P3(C, D, A, B,  3, 16, 0xD4EF3085); \
+	P3(B, C, D, A,  6, 23, 0x04881D05); \
+	P3(A, B, C, D,  9,  4, 0xD9D4D039); \
+	P3(D, A, B, C, 12, 11, 0xE6DB99E5); \
+	P3(C, D, A, B, 15, 16, 0x1FA27CF8); \
+	P3(B, C, D, A,  2, 23, 0xC4AC5665); \
+	\
+	P4(A, B, C, D,  0,  6, 0xF4292244); \
+	P4(D, A, B, C,  7, 10, 0x432AFF97); \
+	P4(C, D, A, B, 14, 15, 0xAB9423A7); \
+	P4(B, C, D, A,  5, 21, 0xFC93A039); \
+	P4(A, B, C, D, 12,  6, 0x655B59C3); \
+	P4(D, A, B, C,  3, 10, 0x8F0CCC92); \
+	P4(C, D, A, B, 10, 15, 0xFFEFF47D); \
+	P4(B, C, D, A,  1, 21, 0x85845DD1); \
+	P4(A, B, C, D,  8,  6, 0x6FA87E4F); \
+	P4(D, A, B, C, 15, 10, 0xFE2CE6E0); \
+	P4(C, D, A, B,  6, 15, 0xA3014314); \
+	P4(B, C, D, A, 13, 21, 0x4E0811A1); \
+	P4(A, B, C, D,  4,  6, 0xF7537E82); \
+	P4(D, A, B, C, 11, 10, 0xBD3AF235); \
+	P4(C, D, A, B,  2, 15, 0x2AD7D2BB); \
+	P4(B, C, D, A,  9, 21, 0xEB86D391)
+
 static void md5_process(md_context *ctx, const uint8_t data[CSUM_CHUNK])
 {
 	uint32_t X[16], A, B, C, D;
+	int i;
 
 	A = ctx->A;
 	B = ctx->B;
 	C = ctx->C;
 	D = ctx->D;
 
-	X[0] = IVAL(data, 0);
-	X[1] = IVAL(data, 4);
-	X[2] = IVAL(data, 8);
-	X[3] = IVAL(data, 12);
-	X[4] = IVAL(data, 16);
-	X[5] = IVAL(data, 20);
-	X[6] = IVAL(data, 24);
-	X[7] = IVAL(data, 28);
-	X[8] = IVAL(data, 32);
-	X[9] = IVAL(data, 36);
-	X[10] = IVAL(data, 40);
-	X[11] = IVAL(data, 44);
-	X[12] = IVAL(data, 48);
-	X[13] = IVAL(data, 52);
-	X[14] = IVAL(data, 56);
-	X[15] = IVAL(data, 60);
-
-#define S(x,n) ((x << n) | ((x & 0xFFFFFFFF) >> (32 - n)))
+	for (i = 0; i < 16; i++)
+		X[i] = IVAL(data, 4 * i);
 
-#define P(a,b,c,d,k,s,t) a += F(b,c,d) + X[k] + t, a = S(a,s) + b
-
-#define F(x,y,z) (z ^ (x & (y ^ z)))
-
-	P(A, B, C, D,  0,  7, 0xD76AA478);
-	P(D, A, B, C,  1, 12, 0xE8C7B756);
-	P(C, D, A, B,  2, 17, 0x242070DB);
-	P(B, C, D, A,  3, 22, 0xC1BDCEEE);
-	P(A, B, C, D,  4,  7, 0xF57C0FAF);
-	P(D, A, B, C,  5, 12, 0x4787C62A);
-	P(C, D, A, B,  6, 17, 0xA8304613);
-	P(B, C, D, A,  7, 22, 0xFD469501);
-	P(A, B, C, D,  8,  7, 0x698098D8);
-	P(D, A, B, C,  9, 12, 0x8B44F7AF);
-	P(C, D, A, B, 10, 17, 0xFFFF5BB1);
-	P(B, C, D, A, 11, 22, 0x895CD7BE);
-	P(A, B, C, D, 12,  7, 0x6B901122);
-	P(D, A, B, C, 13, 12, 0xFD987193);
-	P(C, D, A, B, 14, 17, 0xA679438E);
-	P(B, C, D, A, 15, 22, 0x49B40821);
-
-#undef F
-#define F(x,y,z) (y ^ (z & (x ^ y)))
-
-	P(A, B, C, D,  1,  5, 0xF61E2562);
-	P(D, A, B, C,  6,  9, 0xC040B340);
-	P(C, D, A, B, 11, 14, 0x265E5A51);
-	P(B, C, D, A,  0, 20, 0xE9B6C7AA);
-	P(A, B, C, D,  5,  5, 0xD62F105D);
-	P(D, A, B, C, 10,  9, 0x02441453);
-	P(C, D, A, B, 15, 14, 0xD8A1E681);
-	P(B, C, D, A,  4, 20, 0xE7D3FBC8);
-	P(A, B, C, D,  9,  5, 0x21E1CDE6);
-	P(D, A, B, C, 14,  9, 0xC33707D6);
-	P(C, D, A, B,  3, 14, 0xF4D50D87);
-	P(B, C, D, A,  8, 20, 0x455A14ED);
-	P(A, B, C, D, 13,  5, 0xA9E3E905);
-	P(D, A, B, C,  2,  9, 0xFCEFA3F8);
-	P(C, D, A, B,  7, 14, 0x676F02D9);
-	P(B, C, D, A, 12, 20, 0x8D2A4C8A);
-
-#undef F
-#define F(x,y,z) (x ^ y ^ z)
-
-	P(A, B, C, D,  5,  4, 0xFFFA3942);
-	P(D, A, B, C,  8, 11, 0x8771F681);
-	P(C, D, A, B, 11, 16, 0x6D9D6122);
-	P(B, C, D, A, 14, 23, 0xFDE5380C);
-	P(A, B, C, D,  1,  4, 0xA4BEEA44);
-	P(D, A, B, C,  4, 11, 0x4BDECFA9);
-	P(C, D, A, B,  7, 16, 0xF6BB4B60);
-	P(B, C, D, A, 10, 23, 0xBEBFBC70);
-	P(A, B, C, D, 13,  4, 0x289B7EC6);
-	P(D, A, B, C,  0, 11, 0xEAA127FA);
-	P(C, D, A, B,  3, 16, 0xD4EF3085);
-	P(B, C, D, A,  6, 23, 0x04881D05);
-	P(A, B, C, D,  9,  4, 0xD9D4D039);
-	P(D, A, B, C, 12, 11, 0xE6DB99E5);
-	P(C, D, A, B, 15, 16, 0x1FA27CF8);
-	P(B, C, D, A,  2, 23, 0xC4AC5665);
-
-#undef F
-#define F(x,y,z) (y ^ (x | ~z))
-
-	P(A, B, C, D,  0,  6, 0xF4292244);
-	P(D, A, B, C,  7, 10, 0x432AFF97);
-	P(C, D, A, B, 14, 15, 0xAB9423A7);
-	P(B, C, D, A,  5, 21, 0xFC93A039);
-	P(A, B, C, D, 12,  6, 0x655B59C3);
-	P(D, A, B, C,  3, 10, 0x8F0CCC92);
-	P(C, D, A, B, 10, 15, 0xFFEFF47D);
-	P(B, C, D, A,  1, 21, 0x85845DD1);
-	P(A, B, C, D,  8,  6, 0x6FA87E4F);
-	P(D, A, B, C, 15, 10, 0xFE2CE6E0);
-	P(C, D, A, B,  6, 15, 0xA3014314);
-	P(B, C, D, A, 13, 21, 0x4E0811A1);
-	P(A, B, C, D,  4,  6, 0xF7537E82);
-	P(D, A, B, C, 11, 10, 0xBD3AF235);
-	P(C, D, A, B,  2, 15, 0x2AD7D2BB);
-	P(B, C, D, A,  9, 21, 0xEB86D391);
-
-#undef F
+	MD5_STEPS;
 
 	ctx->A += A;
 	ctx->B += B;
@@ -293,32 +290,66 @@ static void md5_result(md_context *ctx, uint8_t digest[MD5_DIGEST_LEN])
 }
 
 
-static void libevil_md5sum_fd (int fd, uint8_t *out)
-{
-        int        i = 0;
-	md_context ctx;
-	uint8_t    buf[1024];
+/* large enough that the syscalls vanish next to the hashing (md5 runs
+   at ~500MB/s), small enough to come from the heap rather than mmap */
+#define MD5_FD_CHUNK (64 * 1024)
 
-        md5_begin(&ctx);
+/* feed @ctx the rest of @fd from @off on, through @buf of @size bytes.
+   0 at the end of the file, -1 with errno set on a read error */
+static int md5_stream_fd (md_context *ctx, int fd, off_t off,
+                          uint8_t *buf, size_t size)
+{
+        ssize_t n = 0;
+
+        for (;;) {
+                n = pread (fd, buf, size, off);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        return -1;
+                if (n == 0)
+                        return 0;
+                md5_update(ctx, buf, n);
+                off += n;
+        }
+}
 
-        while ((i = read (fd, buf, sizeof buf)) > 0)
-                md5_update(&ctx, buf, i);
+/* digest all of @fd from offset 0, whatever its file position, which is
+   left alone. pread rather than mmap: the file may be truncated under
+   us and a SIGBUS would kill whoever called rename(). returns 0, or -1
+   with errno set when the file could not be read to its end; @out is
+   then no digest of anything.
+*/
+static int libevil_md5sum_fd (int fd, uint8_t *out)
+{
+        md_context ctx;
+        uint8_t    small[1024];
+        uint8_t   *buf = NULL;
+        size_t     size = MD5_FD_CHUNK;
+        int        ret = 0;
+        int        err = 0;
 
-        md5_result(&ctx, out);
-}
+        if (posix_memalign ((void **) &buf, 4096, size) != 0) {
+                buf = small;
+                size = sizeof small;
+        }
 
+        posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-static int libevil_md5sum_file (int dirfd, const char *path, uint8_t *out)
-{
-        int   fd = -1;
+        md5_begin(&ctx);
+        ret = md5_stream_fd (&ctx, fd, 0, buf, size);
 
-        fd = openat (dirfd, path, O_RDONLY, 0);
+        err = errno;
+        if (buf != small)
+                free (buf);
 
-        if (fd < 0)
-                return -errno;
+        if (ret != 0) {
+                errno = err;
+                return -1;
+        }
 
-        libevil_md5sum_fd (fd, out);
+        md5_result(&ctx, out);
 
-        close (fd);
         return 0;
 }
+
@@ -3,7 +3,6 @@
 
 #include <stdint.h>
 
-int libevil_md5sum_file (int dirfd, const char *path, uint8_t *out);
-void libevil_md5sum_fd (int fd, uint8_t *out);
+int libevil_md5sum_fd (int fd, uint8_t *out);
 
 #endif /* ! _MD5_H */
@@ -0,0 +1,1028 @@
+/*
+   Copyright (c) 2011 Gluster, Inc. <http://www.gluster.com>
+   This file is part of GlusterFS.
+
+   GlusterFS is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Affero General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   GlusterFS is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Affero General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+/* Just enough of RFC 4880 to check the clearsigned license.asc and
+   permit.asc against pubring.gpg without running gpgv: armor, canonical
+   text, v3/v4 signature packets and RSA PKCS#1 v1.5 with SHA-1/SHA-2.
+
+   pgp_verify_clearsign() answers YES or NO only for input it fully
+   understands. anything else (other key algorithms, subkeys, expiring
+   or revoked keys, partial lengths, several signatures, text outside
+   the signed block, ...) gets -1 so that the caller asks gpgv, which
+   keeps the verdicts identical to what they were before.
+*/
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "sha.c"
+
+
+#define PGP_MAX_LIMBS    256            /* 8192 bit moduli */
+#define PGP_MAX_KEYS     64
+
+
+struct pgp_key {
+        uint8_t         keyid[8];
+        const uint8_t  *n;
+        size_t          nlen;
+        const uint8_t  *e;
+        size_t          elen;
+        int             unsure;         /* revoked, expiring, not RSA */
+        int             subkey;
+};
+
+
+struct pgp_sig {
+        int             version;
+        int             type;
+        int             pkalgo;
+        int             hashalgo;
+        const uint8_t  *hashed;         /* what goes into the digest */
+        size_t          hashedlen;
+        uint8_t         left16[2];
+        uint8_t         keyid[8];
+        int             have_keyid;
+        const uint8_t  *s;
+        size_t          slen;
+};
+
+
+/* armor */
+
+static uint32_t
+pgp_crc24 (const uint8_t *p, size_t len)
+{
+        uint32_t crc = 0xb704ce;
+        int      i = 0;
+
+        while (len--) {
+                crc ^= (uint32_t) (*p++) << 16;
+                for (i = 0; i < 8; i++) {
+                        crc <<= 1;
+                        if (crc & 0x1000000)
+                                crc ^= 0x1864cfb;
+                }
+        }
+
+        return crc & 0xffffff;
+}
+
+
+static int
+pgp_b64val (int c)
+{
+        if (c >= 'A' && c <= 'Z')
+                return c - 'A';
+        if (c >= 'a' && c <= 'z')
+                return c - 'a' + 26;
+        if (c >= '0' && c <= '9')
+                return c - '0' + 52;
+        if (c == '+')
+                return 62;
+        if (c == '/')
+                return 63;
+        return -1;
+}
+
+
+/* decode base64 from @p..@end ignoring line breaks, stop at '=' padding.
+   returns decoded length or -1 */
+static ssize_t
+pgp_b64decode (const char *p, const char *end, uint8_t *out)
+{
+        uint32_t acc = 0;
+        int      bits = 0;
+        size_t   n = 0;
+        int      v = 0;
+
+        for (; p < end; p++) {
+                if (*p == '\n' || *p == '\r' || *p == ' ' || *p == '\t')
+                        continue;
+                if (*p == '=')
+                        break;
+                v = pgp_b64val (*p);
+                if (v < 0)
+                        return -1;
+                acc = (acc << 6) | v;
+                bits += 6;
+                if (bits >= 8) {
+                        bits -= 8;
+                        out[n++] = acc >> bits;
+                }
+        }
+
+        return n;
+}
+
+
+static const char *
+pgp_nextline (const char *p, const char *end)
+{
+        const char *nl = memchr (p, '\n', end - p);
+
+        return nl ? nl + 1 : end;
+}
+
+
+/* length of the line at @p without its "\r\n" or "\n" */
+static size_t
+pgp_linelen (const char *p, const char *end)
+{
+        const char *q = pgp_nextline (p, end);
+
+        if (q > p && q[-1] == '\n')
+                q--;
+        if (q > p && q[-1] == '\r')
+                q--;
+
+        return q - p;
+}
+
+
+static int
+pgp_isblank (const char *p, size_t len)
+{
+        while (len--)
+                if (*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                        return NO;
+                else
+                        p++;
+
+        return YES;
+}
+
+
+static int
+pgp_lineis (const char *p, const char *end, const char *what)
+{
+        size_t len = pgp_linelen (p, end);
+        size_t wlen = strlen (what);
+
+        while (len > wlen && (p[len-1] == ' ' || p[len-1] == '\t'))
+                len--;
+
+        return (len == wlen && memcmp (p, what, wlen) == 0);
+}
+
+
+/* packets */
+
+/* parse a packet header at @p. on success sets *tag, *body, *bodylen
+   and returns the total packet length, else -1 */
+static ssize_t
+pgp_packet (const uint8_t *p, size_t len, int *tag,
+            const uint8_t **body, size_t *bodylen)
+{
+        size_t hlen = 0;
+        size_t blen = 0;
+
+        if (len < 2 || !(p[0] & 0x80))
+                return -1;
+
+        if (p[0] & 0x40) {
+                *tag = p[0] & 0x3f;
+                if (p[1] < 192) {
+                        hlen = 2;
+                        blen = p[1];
+                } else if (p[1] < 224) {
+                        if (len < 3)
+                                return -1;
+                        hlen = 3;
+                        blen = ((p[1] - 192) << 8) + p[2] + 192;
+                } else if (p[1] == 255) {
+                        if (len < 6)
+                                return -1;
+                        hlen = 6;
+                        blen = ((size_t) p[2] << 24) | (p[3] << 16) |
+                                (p[4] << 8) | p[5];
+                } else {
+                        /* partial body lengths */
+                        return -1;
+                }
+        } else {
+                *tag = (p[0] >> 2) & 0xf;
+                switch (p[0] & 3) {
+                case 0:
+                        hlen = 2;
+                        blen = p[1];
+                        break;
+                case 1:
+                        if (len < 3)
+                                return -1;
+                        hlen = 3;
+                        blen = (p[1] << 8) | p[2];
+                        break;
+                case 2:
+                        if (len < 5)
+                                return -1;
+                        hlen = 5;
+                        blen = ((size_t) p[1] << 24) | (p[2] << 16) |
+                                (p[3] << 8) | p[4];
+                        break;
+                default:
+                        return -1;
+                }
+        }
+
+        if (blen > len - hlen)
+                return -1;
+
+        *body = p + hlen;
+        *bodylen = blen;
+
+        return hlen + blen;
+}
+
+
+/* read an MPI at *p, advance *p. returns byte length or -1 */
+static ssize_t
+pgp_mpi (const uint8_t **p, const uint8_t *end, const uint8_t **val)
+{
+        size_t bits = 0;
+        size_t bytes = 0;
+
+        if (end - *p < 2)
+                return -1;
+
+        bits = ((*p)[0] << 8) | (*p)[1];
+        bytes = (bits + 7) / 8;
+        if ((size_t) (end - *p - 2) < bytes)
+                return -1;
+
+        *val = *p + 2;
+        *p += 2 + bytes;
+
+        /* tolerate leading zero bytes */
+        while (bytes && **val == 0) {
+                (*val)++;
+                bytes--;
+        }
+
+        return bytes;
+}
+
+
+/* walk subpackets. for signatures: fills issuer, flags what we cannot
+   judge. @keyexp gets set if a key expiration time is present */
+static int
+pgp_subpackets (const uint8_t *p, size_t len, int hashed,
+                struct pgp_sig *sig, int *keyexp)
+{
+        const uint8_t *end = p + len;
+        size_t         slen = 0;
+        int            type = 0;
+
+        while (p < end) {
+                if (p[0] < 192) {
+                        slen = p[0];
+                        p += 1;
+                } else if (p[0] < 255) {
+                        if (end - p < 2)
+                                return -1;
+                        slen = ((p[0] - 192) << 8) + p[1] + 192;
+                        p += 2;
+                } else {
+                        if (end - p < 5)
+                                return -1;
+                        slen = ((size_t) p[1] << 24) | (p[2] << 16) |
+                                (p[3] << 8) | p[4];
+                        p += 5;
+                }
+
+                if (slen == 0 || slen > (size_t) (end - p))
+                        return -1;
+
+                type = p[0] & 0x7f;
+
+                switch (type) {
+                case 3:         /* signature expiration */
+                        if (hashed)
+                                return -1;
+                        break;
+                case 9:         /* key expiration */
+                        if (hashed && keyexp)
+                                *keyexp = YES;
+                        break;
+                case 16:        /* issuer */
+                        if (slen == 9 && sig && !sig->have_keyid) {
+                                memcpy (sig->keyid, p + 1, 8);
+                                sig->have_keyid = YES;
+                        }
+                        break;
+                case 33:        /* issuer fingerprint, v4 keys */
+                        if (slen == 22 && p[1] == 4 && sig) {
+                                memcpy (sig->keyid, p + 14, 8);
+                                sig->have_keyid = YES;
+                        }
+                        break;
+                case 2:         /* creation time */
+                case 4:         /* exportable */
+                case 11: case 21: case 22: case 23: case 25:
+                case 27: case 30:
+                        break;
+                default:
+                        if (hashed && (p[0] & 0x80))
+                                return -1;
+                        break;
+                }
+
+                p += slen;
+        }
+
+        return 0;
+}
+
+
+static int
+pgp_parse_sig (const uint8_t *b, size_t len, struct pgp_sig *sig, int *keyexp)
+{
+        const uint8_t *end = b + len;
+        const uint8_t *p = b;
+        size_t         hlen = 0;
+        size_t         ulen = 0;
+        ssize_t        n = 0;
+
+        memset (sig, 0, sizeof (*sig));
+
+        if (len < 1)
+                return -1;
+        sig->version = b[0];
+
+        if (sig->version == 3 || sig->version == 2) {
+                /* ver, 5, type, time[4], keyid[8], pkalgo, hashalgo, left16 */
+                if (len < 19 || b[1] != 5)
+                        return -1;
+                sig->type = b[2];
+                sig->hashed = b + 2;
+                sig->hashedlen = 5;
+                memcpy (sig->keyid, b + 7, 8);
+                sig->have_keyid = YES;
+                sig->pkalgo = b[15];
+                sig->hashalgo = b[16];
+                memcpy (sig->left16, b + 17, 2);
+                p = b + 19;
+        } else if (sig->version == 4) {
+                if (len < 6)
+                        return -1;
+                sig->type = b[1];
+                sig->pkalgo = b[2];
+                sig->hashalgo = b[3];
+                hlen = (b[4] << 8) | b[5];
+                p = b + 6;
+                if ((size_t) (end - p) < hlen + 2)
+                        return -1;
+                if (pgp_subpackets (p, hlen, YES, sig, keyexp) != 0)
+                        return -1;
+                sig->hashed = b;
+                sig->hashedlen = 6 + hlen;
+                p += hlen;
+
+                ulen = (p[0] << 8) | p[1];
+                p += 2;
+                if ((size_t) (end - p) < ulen + 2)
+                        return -1;
+                if (pgp_subpackets (p, ulen, NO, sig, NULL) != 0)
+                        return -1;
+                p += ulen;
+
+                memcpy (sig->left16, p, 2);
+                p += 2;
+        } else {
+                return -1;
+        }
+
+        if (sig->pkalgo != 1 && sig->pkalgo != 3)
+                return -1;
+
+        n = pgp_mpi (&p, end, &sig->s);
+        if (n < 1)
+                return -1;
+        sig->slen = n;
+
+        return 0;
+}
+
+
+static int
+pgp_parse_key (const uint8_t *b, size_t len, struct pgp_key *key)
+{
+        const uint8_t *end = b + len;
+        const uint8_t *p = b;
+        uint8_t        fpr[20];
+        uint8_t        hdr[3];
+        sha_ctx        ctx;
+        ssize_t        n = 0;
+        int            algo = 0;
+
+        memset (key, 0, sizeof (*key));
+
+        if (len < 1)
+                return -1;
+
+        if (b[0] == 4) {
+                if (len < 6)
+                        return -1;
+                algo = b[5];
+                p = b + 6;
+        } else if (b[0] == 2 || b[0] == 3) {
+                if (len < 8)
+                        return -1;
+                algo = b[7];
+                p = b + 8;
+        } else {
+                key->unsure = YES;
+                return 0;
+        }
+
+        if (algo != 1 && algo != 3) {
+                key->unsure = YES;
+                return 0;
+        }
+
+        n = pgp_mpi (&p, end, &key->n);
+        if (n < 8)
+                return -1;
+        key->nlen = n;
+
+        n = pgp_mpi (&p, end, &key->e);
+        if (n < 1)
+                return -1;
+        key->elen = n;
+
+        if (b[0] == 4) {
+                hdr[0] = 0x99;
+                hdr[1] = len >> 8;
+                hdr[2] = len;
+                sha_begin (&ctx, SHA_1);
+                sha_update (&ctx, hdr, 3);
+                sha_update (&ctx, b, len);
+                sha_result (&ctx, fpr);
+                memcpy (key->keyid, fpr + 12, 8);
+        } else {
+                memcpy (key->keyid, key->n + key->nlen - 8, 8);
+        }
+
+        return 0;
+}
+
+
+/* collect keys from a binary keyring. returns count or -1 */
+static int
+pgp_parse_keyring (const uint8_t *p, size_t len, struct pgp_key *keys)
+{
+        const uint8_t   *body = NULL;
+        size_t           blen = 0;
+        ssize_t          plen = 0;
+        int              tag = 0;
+        int              cnt = 0;
+        int              keyexp = NO;
+        struct pgp_sig   sig;
+        struct pgp_key  *cur = NULL;
+
+        while (len) {
+                plen = pgp_packet (p, len, &tag, &body, &blen);
+                if (plen < 0)
+                        return -1;
+
+                switch (tag) {
+                case 6:
+                case 14:
+                        if (cnt == PGP_MAX_KEYS)
+                                return -1;
+                        cur = &keys[cnt];
+                        if (pgp_parse_key (body, blen, cur) != 0)
+                                return -1;
+                        cur->subkey = (tag == 14);
+                        cnt++;
+                        break;
+                case 2:
+                        if (!cur)
+                                break;
+                        keyexp = NO;
+                        if (pgp_parse_sig (body, blen, &sig, &keyexp) != 0 ||
+                            sig.type == 0x20 || sig.type == 0x28 ||
+                            sig.type == 0x30 || keyexp)
+                                cur->unsure = YES;
+                        break;
+                default:
+                        break;
+                }
+
+                p += plen;
+                len -= plen;
+        }
+
+        return cnt;
+}
+
+
+/* RSA */
+
+static void
+pgp_bn_frombytes (uint32_t *r, int limbs, const uint8_t *p, size_t len)
+{
+        int i = 0;
+
+        memset (r, 0, limbs * sizeof (*r));
+        for (i = 0; len; i++, len--)
+                r[i / 4] |= (uint32_t) p[len - 1] << (8 * (i % 4));
+}
+
+
+static int
+pgp_bn_cmp (const uint32_t *a, const uint32_t *b, int limbs)
+{
+        while (limbs--)
+                if (a[limbs] != b[limbs])
+                        return a[limbs] < b[limbs] ? -1 : 1;
+
+        return 0;
+}
+
+
+static void
+pgp_bn_sub (uint32_t *a, const uint32_t *b, int limbs)
+{
+        uint64_t borrow = 0;
+        uint64_t t = 0;
+        int      i = 0;
+
+        for (i = 0; i < limbs; i++) {
+                t = (uint64_t) a[i] - b[i] - borrow;
+                a[i] = t;
+                borrow = (t >> 32) & 1;
+        }
+}
+
+
+/* r = a * b / R mod n, CIOS */
+static void
+pgp_mont_mul (uint32_t *r, const uint32_t *a, const uint32_t *b,
+              const uint32_t *n, uint32_t n0inv, int limbs)
+{
+        uint32_t t[PGP_MAX_LIMBS + 2];
+        uint64_t c = 0;
+        uint32_t m = 0;
+        int      i = 0;
+        int      j = 0;
+
+        memset (t, 0, (limbs + 2) * sizeof (*t));
+
+        for (i = 0; i < limbs; i++) {
+                c = 0;
+                for (j = 0; j < limbs; j++) {
+                        c += (uint64_t) a[j] * b[i] + t[j];
+                        t[j] = c;
+                        c >>= 32;
+                }
+                c += t[limbs];
+                t[limbs] = c;
+                t[limbs + 1] = c >> 32;
+
+                m = t[0] * n0inv;
+                c = ((uint64_t) m * n[0] + t[0]) >> 32;
+                for (j = 1; j < limbs; j++) {
+                        c += (uint64_t) m * n[j] + t[j];
+                        t[j - 1] = c;
+                        c >>= 32;
+                }
+                c += t[limbs];
+                t[limbs - 1] = c;
+                t[limbs] = t[limbs + 1] + (c >> 32);
+        }
+
+        if (t[limbs] || pgp_bn_cmp (t, n, limbs) >= 0)
+                pgp_bn_sub (t, n, limbs);
+
+        memcpy (r, t, limbs * sizeof (*r));
+}
+
+
+/* out = s^e mod n as big-endian bytes of length nlen. returns 0 or -1 */
+static int
+pgp_rsa_public (const struct pgp_key *key, const uint8_t *s, size_t slen,
+                uint8_t *out)
+{
+        uint32_t n[PGP_MAX_LIMBS];
+        uint32_t x[PGP_MAX_LIMBS];
+        uint32_t acc[PGP_MAX_LIMBS];
+        uint32_t one[PGP_MAX_LIMBS];
+        uint32_t n0inv = 1;
+        uint32_t carry = 0;
+        int      limbs = 0;
+        int      i = 0;
+        int      j = 0;
+        int      started = NO;
+        int      t = 0;
+        int      sq = 0;
+        size_t   k = 0;
+
+        limbs = (key->nlen + 3) / 4;
+        if (limbs > PGP_MAX_LIMBS || slen > key->nlen)
+                return -1;
+
+        pgp_bn_frombytes (n, limbs, key->n, key->nlen);
+        if (!(n[0] & 1))
+                return -1;
+
+        pgp_bn_frombytes (x, limbs, s, slen);
+        if (pgp_bn_cmp (x, n, limbs) >= 0)
+                return -1;
+
+        for (i = 0; i < 5; i++)
+                n0inv *= 2 - n[0] * n0inv;
+        n0inv = -n0inv;
+
+        /* R^2 mod n: with 32 * limbs = t << j, double 1 up to 2^t R and
+           square that j times in Montgomery form, which is far cheaper
+           than doubling all the way */
+        for (sq = 0, t = 32 * limbs; !(t & 1); t >>= 1)
+                sq++;
+        memset (acc, 0, sizeof (acc));
+        acc[0] = 1;
+        for (i = 0; i < 32 * limbs + t; i++) {
+                carry = acc[limbs - 1] >> 31;
+                for (j = limbs - 1; j > 0; j--)
+                        acc[j] = (acc[j] << 1) | (acc[j - 1] >> 31);
+                acc[0] <<= 1;
+                if (carry || pgp_bn_cmp (acc, n, limbs) >= 0)
+                        pgp_bn_sub (acc, n, limbs);
+        }
+        while (sq--)
+                pgp_mont_mul (acc, acc, acc, n, n0inv, limbs);
+
+        /* x into Montgomery form */
+        pgp_mont_mul (x, x, acc, n, n0inv, limbs);
+
+        for (i = 0; i < (int) key->elen; i++) {
+                for (j = 7; j >= 0; j--) {
+                        if (started)
+                                pgp_mont_mul (acc, acc, acc, n, n0inv, limbs);
+                        if (key->e[i] & (1 << j)) {
+                                if (started)
+                                        pgp_mont_mul (acc, acc, x, n, n0inv,
+                                                      limbs);
+                                else
+                                        memcpy (acc, x, sizeof (acc));
+                                started = YES;
+                        }
+                }
+        }
+        if (!started)
+                return -1;
+
+        memset (one, 0, sizeof (one));
+        one[0] = 1;
+        pgp_mont_mul (acc, acc, one, n, n0inv, limbs);
+
+        for (k = 0; k < key->nlen; k++)
+                out[key->nlen - 1 - k] = acc[k / 4] >> (8 * (k % 4));
+
+        return 0;
+}
+
+
+static const uint8_t *
+pgp_digestinfo (int hashalgo, int *algo, size_t *len)
+{
+        static const uint8_t sha1[] = {
+                0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2b, 0x0e,
+                0x03, 0x02, 0x1a, 0x05, 0x00, 0x04, 0x14,
+        };
+        static const uint8_t sha224[] = {
+                0x30, 0x2d, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+                0x65, 0x03, 0x04, 0x02, 0x04, 0x05, 0x00, 0x04, 0x1c,
+        };
+        static const uint8_t sha256[] = {
+                0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+                0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20,
+        };
+        static const uint8_t sha384[] = {
+                0x30, 0x41, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+                0x65, 0x03, 0x04, 0x02, 0x02, 0x05, 0x00, 0x04, 0x30,
+        };
+        static const uint8_t sha512[] = {
+                0x30, 0x51, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+                0x65, 0x03, 0x04, 0x02, 0x03, 0x05, 0x00, 0x04, 0x40,
+        };
+
+        switch (hashalgo) {
+        case 2:
+                *algo = SHA_1;
+                *len = sizeof (sha1);
+                return sha1;
+        case 8:
+                *algo = SHA_256;
+                *len = sizeof (sha256);
+                return sha256;
+        case 9:
+                *algo = SHA_384;
+                *len = sizeof (sha384);
+                return sha384;
+        case 10:
+                *algo = SHA_512;
+                *len = sizeof (sha512);
+                return sha512;
+        case 11:
+                *algo = SHA_224;
+                *len = sizeof (sha224);
+                return sha224;
+        }
+
+        return NULL;
+}
+
+
+/* clearsign */
+
+/* add the algorithms named by the "Hash:" armor header @p..@p+len to
+   @mask, as 1 << hashalgo. -1 on anything but a comma separated list
+   of the exact names gpg writes, which gpg may read differently */
+static int
+pgp_hash_header (const char *p, size_t len, unsigned int *mask)
+{
+        static const struct {
+                const char *name;
+                int         algo;
+        } names[] = {
+                { "SHA1",      2 },
+                { "RIPEMD160", 3 },
+                { "SHA256",    8 },
+                { "SHA384",    9 },
+                { "SHA512",   10 },
+                { "SHA224",   11 },
+        };
+        const char *end = p + len;
+        const char *q = NULL;
+        size_t      i = 0;
+
+        for (p += 5; ; p++) {
+                while (p < end && (*p == ' ' || *p == '\t'))
+                        p++;
+                for (q = p; q < end && *q != ',' && *q != ' ' &&
+                             *q != '\t'; q++)
+                        ;
+
+                for (i = 0; i < sizeof (names) / sizeof (names[0]); i++)
+                        if (strlen (names[i].name) == (size_t) (q - p) &&
+                            memcmp (names[i].name, p, q - p) == 0)
+                                break;
+                if (i == sizeof (names) / sizeof (names[0]))
+                        return -1;
+                *mask |= 1U << names[i].algo;
+
+                for (p = q; p < end && (*p == ' ' || *p == '\t'); p++)
+                        ;
+                if (p == end)
+                        return 0;
+                if (*p != ',')
+                        return -1;
+        }
+}
+
+
+/* feed the canonical form of the cleartext in @p..@end: dash-escapes
+   undone, trailing blanks dropped, CRLF between lines, none after the
+   last. returns -1 on a line we do not want to interpret */
+static int
+pgp_hash_text (sha_ctx *ctx, const char *p, const char *end)
+{
+        const char *nl = NULL;
+        size_t      len = 0;
+
+        for (;;) {
+                len = pgp_linelen (p, end);
+                nl = memchr (p, '\n', end - p);
+
+                if (len && p[0] == '-') {
+                        if (len < 2 || p[1] != ' ')
+                                return -1;
+                        p += 2;
+                        len -= 2;
+                }
+
+                while (len && (p[len-1] == ' ' || p[len-1] == '\t' ||
+                               p[len-1] == '\r'))
+                        len--;
+
+                sha_update (ctx, p, len);
+
+                if (!nl)
+                        break;
+                sha_update (ctx, "\r\n", 2);
+                p = nl + 1;
+        }
+
+        return 0;
+}
+
+
+static int
+pgp_verify_clearsign (const char *buf, size_t len,
+                      const uint8_t *keyring, size_t keylen)
+{
+        static const char begin_msg[] = "-----BEGIN PGP SIGNED MESSAGE-----";
+        static const char begin_sig[] = "-----BEGIN PGP SIGNATURE-----";
+        static const char end_sig[] = "-----END PGP SIGNATURE-----";
+        const char      *end = buf + len;
+        const char      *p = buf;
+        const char      *text = NULL;
+        const char      *textend = NULL;
+        const char      *armor = NULL;
+        const char      *crcline = NULL;
+        uint8_t         *raw = NULL;
+        ssize_t          rawlen = 0;
+        uint8_t          crcbuf[3];
+        const uint8_t   *body = NULL;
+        size_t           blen = 0;
+        ssize_t          plen = 0;
+        int              tag = 0;
+        struct pgp_sig   sig;
+        struct pgp_key   keys[PGP_MAX_KEYS];
+        struct pgp_key  *key = NULL;
+        int              nkeys = 0;
+        int              algo = 0;
+        const uint8_t   *di = NULL;
+        size_t           dilen = 0;
+        size_t           dlen = 0;
+        uint8_t          digest[64];
+        uint8_t          em[PGP_MAX_LIMBS * 4];
+        uint8_t          want[PGP_MAX_LIMBS * 4];
+        uint8_t          trailer[6];
+        unsigned int     hashes = 0;
+        sha_ctx          ctx;
+        size_t           k = 0;
+        int              i = 0;
+        int              ret = -1;
+
+        /* nothing but blank lines around the signed block */
+        while (p < end && pgp_isblank (p, pgp_linelen (p, end)))
+                p = pgp_nextline (p, end);
+        if (p == end || !pgp_lineis (p, end, begin_msg))
+                return -1;
+        p = pgp_nextline (p, end);
+
+        /* armor headers, only Hash: is meaningful here. gpgv refuses a
+           signature whose algorithm they do not name; without any, what
+           it assumes depends on its version */
+        while (p < end && pgp_linelen (p, end) != 0) {
+                if (pgp_linelen (p, end) < 5 || memcmp (p, "Hash:", 5) != 0)
+                        return -1;
+                if (pgp_hash_header (p, pgp_linelen (p, end), &hashes) != 0)
+                        return -1;
+                p = pgp_nextline (p, end);
+        }
+        if (p == end || !hashes)
+                return -1;
+        text = p = pgp_nextline (p, end);
+
+        while (p < end && !pgp_lineis (p, end, begin_sig)) {
+                if (pgp_lineis (p, end, begin_msg))
+                        return -1;
+                p = pgp_nextline (p, end);
+        }
+        if (p == end)
+                return -1;
+        /* the line break before BEGIN belongs to the armor */
+        textend = p;
+        if (textend > text && textend[-1] == '\n')
+                textend--;
+        if (textend > text && textend[-1] == '\r')
+                textend--;
+
+        /* signature armor headers (Version:, Comment:) up to a blank line */
+        p = pgp_nextline (p, end);
+        while (p < end && !pgp_isblank (p, pgp_linelen (p, end))) {
+                if (!memchr (p, ':', pgp_linelen (p, end)))
+                        return -1;
+                p = pgp_nextline (p, end);
+        }
+        if (p == end)
+                return -1;
+        armor = p = pgp_nextline (p, end);
+
+        while (p < end && !pgp_lineis (p, end, end_sig)) {
+                if (*p == '=')
+                        crcline = p;
+                p = pgp_nextline (p, end);
+        }
+        if (p == end)
+                return -1;
+
+        for (p = pgp_nextline (p, end); p < end; p = pgp_nextline (p, end))
+                if (!pgp_isblank (p, pgp_linelen (p, end)))
+                        return -1;
+
+        raw = malloc (p - armor);
+        if (!raw)
+                return -1;
+
+        rawlen = pgp_b64decode (armor, crcline ? crcline : p, raw);
+        if (rawlen <= 0)
+                goto out;
+
+        if (crcline) {
+                if (pgp_linelen (crcline, end) != 5 ||
+                    pgp_b64decode (crcline + 1, crcline + 5, crcbuf) != 3)
+                        goto out;
+                if (pgp_crc24 (raw, rawlen) !=
+                    (uint32_t) ((crcbuf[0] << 16) | (crcbuf[1] << 8) |
+                                crcbuf[2])) {
+                        ret = NO;
+                        goto out;
+                }
+        }
+
+        /* exactly one signature packet */
+        plen = pgp_packet (raw, rawlen, &tag, &body, &blen);
+        if (plen != rawlen || tag != 2)
+                goto out;
+
+        if (pgp_parse_sig (body, blen, &sig, NULL) != 0)
+                goto out;
+        if (sig.type != 0x01 || !sig.have_keyid)
+                goto out;
+
+        if (sig.hashalgo >= 32 || !(hashes & (1U << sig.hashalgo))) {
+                ret = NO;
+                goto out;
+        }
+
+        di = pgp_digestinfo (sig.hashalgo, &algo, &dilen);
+        if (!di)
+                goto out;
+
+        nkeys = pgp_parse_keyring (keyring, keylen, keys);
+        if (nkeys < 0)
+                goto out;
+        for (i = 0; i < nkeys; i++)
+                if (memcmp (keys[i].keyid, sig.keyid, 8) == 0)
+                        key = &keys[i];
+        if (!key) {
+                /* no such key is a plain failure for gpgv too */
+                ret = NO;
+                goto out;
+        }
+        if (key->unsure || key->subkey)
+                goto out;
+
+        sha_begin (&ctx, algo);
+        if (pgp_hash_text (&ctx, text, textend) != 0)
+                goto out;
+        sha_update (&ctx, sig.hashed, sig.hashedlen);
+        if (sig.version == 4) {
+                trailer[0] = 4;
+                trailer[1] = 0xff;
+                trailer[2] = sig.hashedlen >> 24;
+                trailer[3] = sig.hashedlen >> 16;
+                trailer[4] = sig.hashedlen >> 8;
+                trailer[5] = sig.hashedlen;
+                sha_update (&ctx, trailer, 6);
+        }
+        sha_result (&ctx, digest);
+        dlen = sha_digest_len (algo);
+
+        ret = NO;
+
+        if (memcmp (digest, sig.left16, 2) != 0)
+                goto out;
+
+        /* EMSA-PKCS1-v1_5: 00 01 ff.. 00 DigestInfo H */
+        k = key->nlen;
+        if (k < dilen + dlen + 11)
+                goto out;
+        memset (want, 0xff, k);
+        want[0] = 0x00;
+        want[1] = 0x01;
+        want[k - dlen - dilen - 1] = 0x00;
+        memcpy (want + k - dlen - dilen, di, dilen);
+        memcpy (want + k - dlen, digest, dlen);
+
+        if (pgp_rsa_public (key, sig.s, sig.slen, em) != 0)
+                goto out;
+
+        if (memcmp (em, want, k) == 0)
+                ret = YES;
+out:
+        free (raw);
+
+        return ret;
+}
@@ -0,0 +1,658 @@
+/*
+   Copyright (c) 2011 Gluster, Inc. <http://www.gluster.com>
+   This file is part of GlusterFS.
+
+   GlusterFS is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Affero General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   GlusterFS is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Affero General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+/* FIPS 180-4 SHA-1, SHA-224/256 and SHA-384/512, for the signature
+   checks in pgp.c and the sha256 permits. plain portable C, big-endian
+   loads done bytewise; SHA-256 uses the cpu's own rounds if it has them.
+*/
+
+#ifndef LE_SHA_C
+#define LE_SHA_C
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+
+#define ROTL32(x, n)  (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR32(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTR64(x, n)  (((x) >> (n)) | ((x) << (64 - (n))))
+
+
+static uint32_t
+sha_load32 (const uint8_t *p)
+{
+        return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+                ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+
+static uint64_t
+sha_load64 (const uint8_t *p)
+{
+        return ((uint64_t) sha_load32 (p) << 32) | sha_load32 (p + 4);
+}
+
+
+static void
+sha_store32 (uint8_t *p, uint32_t v)
+{
+        p[0] = v >> 24;
+        p[1] = v >> 16;
+        p[2] = v >> 8;
+        p[3] = v;
+}
+
+
+static void
+sha_store64 (uint8_t *p, uint64_t v)
+{
+        sha_store32 (p, v >> 32);
+        sha_store32 (p + 4, v);
+}
+
+
+/* SHA-1 and SHA-256 share the 64 byte block framing, SHA-512 its own */
+
+typedef struct {
+        uint32_t        h[8];
+        uint64_t        len;
+        uint8_t         buf[64];
+        unsigned int    used;
+} sha32_ctx;
+
+
+typedef struct {
+        uint64_t        h[8];
+        uint64_t        len;            /* bytes; 2^64 is plenty here */
+        uint8_t         buf[128];
+        unsigned int    used;
+} sha64_ctx;
+
+
+static void
+sha1_block (uint32_t *h, const uint8_t *p)
+{
+        uint32_t w[80];
+        uint32_t a, b, c, d, e, f, k, t;
+        int      i = 0;
+
+        for (i = 0; i < 16; i++)
+                w[i] = sha_load32 (p + 4 * i);
+        for (; i < 80; i++)
+                w[i] = ROTL32 (w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+        a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+
+        for (i = 0; i < 80; i++) {
+                if (i < 20) {
+                        f = (b & c) | (~b & d);
+                        k = 0x5a827999;
+                } else if (i < 40) {
+                        f = b ^ c ^ d;
+                        k = 0x6ed9eba1;
+                } else if (i < 60) {
+                        f = (b & c) | (b & d) | (c & d);
+                        k = 0x8f1bbcdc;
+                } else {
+                        f = b ^ c ^ d;
+                        k = 0xca62c1d6;
+                }
+
+                t = ROTL32 (a, 5) + f + e + k + w[i];
+                e = d; d = c; c = ROTL32 (b, 30); b = a; a = t;
+        }
+
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+
+static const uint32_t sha256_k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+        0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+        0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+        0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+        0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+        0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+
+static void
+sha256_block (uint32_t *h, const uint8_t *p)
+{
+        uint32_t w[64];
+        uint32_t a, b, c, d, e, f, g, hh, s0, s1, t1, t2;
+        int      i = 0;
+
+        for (i = 0; i < 16; i++)
+                w[i] = sha_load32 (p + 4 * i);
+        for (; i < 64; i++) {
+                s0 = ROTR32 (w[i-15], 7) ^ ROTR32 (w[i-15], 18) ^
+                        (w[i-15] >> 3);
+                s1 = ROTR32 (w[i-2], 17) ^ ROTR32 (w[i-2], 19) ^
+                        (w[i-2] >> 10);
+                w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+
+        a = h[0]; b = h[1]; c = h[2]; d = h[3];
+        e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+
+        for (i = 0; i < 64; i++) {
+                s1 = ROTR32 (e, 6) ^ ROTR32 (e, 11) ^ ROTR32 (e, 25);
+                t1 = hh + s1 + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+                s0 = ROTR32 (a, 2) ^ ROTR32 (a, 13) ^ ROTR32 (a, 22);
+                t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+                hh = g; g = f; f = e; e = d + t1;
+                d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+        h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+
+/* sha-ni: the state lives as ABEF/CDGH halves, each sha256rnds2 does
+   two rounds, msg1/msg2 extend the schedule four words at a time. every
+   cpu with sha-ni has the ssse3/sse4.1 shuffles around them. */
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_HW
+
+__attribute__ ((target ("sha,sse4.1")))
+static void
+sha256_block_hw (uint32_t *h, const uint8_t *p)
+{
+        const __m128i bswap = _mm_set_epi64x (0x0c0d0e0f08090a0bULL,
+                                              0x0405060700010203ULL);
+        __m128i       w[4], msg, tmp, abef, cdgh, abef0, cdgh0;
+        int           i = 0;
+
+        tmp = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *) h),
+                                 0xb1);                         /* CDAB */
+        cdgh = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *) (h + 4)),
+                                  0x1b);                        /* EFGH */
+        abef = _mm_alignr_epi8 (tmp, cdgh, 8);
+        cdgh = _mm_blend_epi16 (cdgh, tmp, 0xf0);
+        abef0 = abef;
+        cdgh0 = cdgh;
+
+        for (i = 0; i < 16; i++) {
+                if (i < 4)
+                        w[i] = _mm_shuffle_epi8 (
+                                _mm_loadu_si128 ((const __m128i *) (p + 16 * i)),
+                                bswap);
+                else
+                        w[i & 3] = _mm_sha256msg2_epu32 (
+                                _mm_add_epi32 (
+                                        _mm_sha256msg1_epu32 (w[i & 3],
+                                                              w[(i + 1) & 3]),
+                                        _mm_alignr_epi8 (w[(i + 3) & 3],
+                                                         w[(i + 2) & 3], 4)),
+                                w[(i + 3) & 3]);
+
+                msg = _mm_add_epi32 (w[i & 3], _mm_loadu_si128 (
+                                     (const __m128i *) &sha256_k[4 * i]));
+                cdgh = _mm_sha256rnds2_epu32 (cdgh, abef, msg);
+                abef = _mm_sha256rnds2_epu32 (abef, cdgh,
+                                              _mm_shuffle_epi32 (msg, 0x0e));
+        }
+
+        abef = _mm_add_epi32 (abef, abef0);
+        cdgh = _mm_add_epi32 (cdgh, cdgh0);
+
+        tmp = _mm_shuffle_epi32 (abef, 0x1b);                   /* FEBA */
+        cdgh = _mm_shuffle_epi32 (cdgh, 0xb1);                  /* DCHG */
+        _mm_storeu_si128 ((__m128i *) h, _mm_blend_epi16 (tmp, cdgh, 0xf0));
+        _mm_storeu_si128 ((__m128i *) (h + 4), _mm_alignr_epi8 (cdgh, tmp, 8));
+}
+
+
+static int
+sha256_hw_usable (void)
+{
+        unsigned int a, b, c, d;
+
+        if (!__get_cpuid (1, &a, &b, &c, &d) ||
+            !(c & bit_SSSE3) || !(c & bit_SSE4_1))
+                return 0;
+
+        if (!__get_cpuid_count (7, 0, &a, &b, &c, &d))
+                return 0;
+
+        return !!(b & bit_SHA);
+}
+
+/* armv8 crypto extension: sha256h/h2 take four rounds, su0/su1 extend
+   the schedule */
+#elif defined(__aarch64__)
+#define SHA256_HW
+
+__attribute__ ((target ("arch=armv8-a+crypto")))
+static void
+sha256_block_hw (uint32_t *h, const uint8_t *p)
+{
+        uint32x4_t w[4], wk, tmp, abcd, efgh, abcd0, efgh0;
+        int        i = 0;
+
+        abcd = abcd0 = vld1q_u32 (h);
+        efgh = efgh0 = vld1q_u32 (h + 4);
+
+        for (i = 0; i < 4; i++)
+                w[i] = vreinterpretq_u32_u8 (vrev32q_u8 (vld1q_u8 (p + 16 * i)));
+
+        for (i = 0; i < 16; i++) {
+                wk = vaddq_u32 (w[i & 3], vld1q_u32 (&sha256_k[4 * i]));
+                if (i < 12)
+                        w[i & 3] = vsha256su1q_u32 (
+                                vsha256su0q_u32 (w[i & 3], w[(i + 1) & 3]),
+                                w[(i + 2) & 3], w[(i + 3) & 3]);
+                tmp = abcd;     /* h2 wants abcd from before this step */
+                abcd = vsha256hq_u32 (abcd, efgh, wk);
+                efgh = vsha256h2q_u32 (efgh, tmp, wk);
+        }
+
+        vst1q_u32 (h, vaddq_u32 (abcd, abcd0));
+        vst1q_u32 (h + 4, vaddq_u32 (efgh, efgh0));
+}
+
+
+static int
+sha256_hw_usable (void)
+{
+        return !!(getauxval (AT_HWCAP) & HWCAP_SHA2);
+}
+#endif
+
+
+/* sha256_block or the cpu's version of it, looked up once */
+static void
+(*sha256_block_pick (void)) (uint32_t *, const uint8_t *)
+{
+#ifdef SHA256_HW
+        static int hw = -1;
+        int        usable = __atomic_load_n (&hw, __ATOMIC_RELAXED);
+
+        if (usable < 0) {
+                usable = sha256_hw_usable ();
+                __atomic_store_n (&hw, usable, __ATOMIC_RELAXED);
+        }
+        if (usable)
+                return sha256_block_hw;
+#endif
+        return sha256_block;
+}
+
+
+static const uint64_t sha512_k[80] = {
+        0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
+        0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+        0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
+        0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+        0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+        0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+        0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL,
+        0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+        0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL,
+        0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+        0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL,
+        0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+        0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL,
+        0x92722c851482353bULL, 0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+        0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+        0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+        0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL,
+        0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+        0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL,
+        0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+        0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL,
+        0xc67178f2e372532bULL, 0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+        0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL,
+        0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+        0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+        0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+        0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+
+static void
+sha512_block (uint64_t *h, const uint8_t *p)
+{
+        uint64_t w[80];
+        uint64_t a, b, c, d, e, f, g, hh, s0, s1, t1, t2;
+        int      i = 0;
+
+        for (i = 0; i < 16; i++)
+                w[i] = sha_load64 (p + 8 * i);
+        for (; i < 80; i++) {
+                s0 = ROTR64 (w[i-15], 1) ^ ROTR64 (w[i-15], 8) ^
+                        (w[i-15] >> 7);
+                s1 = ROTR64 (w[i-2], 19) ^ ROTR64 (w[i-2], 61) ^
+                        (w[i-2] >> 6);
+                w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+
+        a = h[0]; b = h[1]; c = h[2]; d = h[3];
+        e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+
+        for (i = 0; i < 80; i++) {
+                s1 = ROTR64 (e, 14) ^ ROTR64 (e, 18) ^ ROTR64 (e, 41);
+                t1 = hh + s1 + ((e & f) ^ (~e & g)) + sha512_k[i] + w[i];
+                s0 = ROTR64 (a, 28) ^ ROTR64 (a, 34) ^ ROTR64 (a, 39);
+                t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+                hh = g; g = f; f = e; e = d + t1;
+                d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+        h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+
+static void
+sha32_update (sha32_ctx *ctx, void (*block) (uint32_t *, const uint8_t *),
+              const uint8_t *p, size_t len)
+{
+        size_t n = 0;
+
+        ctx->len += len;
+
+        if (ctx->used) {
+                n = 64 - ctx->used;
+                if (n > len)
+                        n = len;
+                memcpy (ctx->buf + ctx->used, p, n);
+                ctx->used += n;
+                p += n;
+                len -= n;
+                if (ctx->used < 64)
+                        return;
+                block (ctx->h, ctx->buf);
+                ctx->used = 0;
+        }
+
+        for (; len >= 64; p += 64, len -= 64)
+                block (ctx->h, p);
+
+        memcpy (ctx->buf, p, len);
+        ctx->used = len;
+}
+
+
+static void
+sha32_final (sha32_ctx *ctx, void (*block) (uint32_t *, const uint8_t *))
+{
+        uint64_t bits = ctx->len * 8;
+
+        ctx->buf[ctx->used++] = 0x80;
+        if (ctx->used > 56) {
+                memset (ctx->buf + ctx->used, 0, 64 - ctx->used);
+                block (ctx->h, ctx->buf);
+                ctx->used = 0;
+        }
+        memset (ctx->buf + ctx->used, 0, 56 - ctx->used);
+        sha_store64 (ctx->buf + 56, bits);
+        block (ctx->h, ctx->buf);
+}
+
+
+static void
+sha64_update (sha64_ctx *ctx, const uint8_t *p, size_t len)
+{
+        size_t n = 0;
+
+        ctx->len += len;
+
+        if (ctx->used) {
+                n = 128 - ctx->used;
+                if (n > len)
+                        n = len;
+                memcpy (ctx->buf + ctx->used, p, n);
+                ctx->used += n;
+                p += n;
+                len -= n;
+                if (ctx->used < 128)
+                        return;
+                sha512_block (ctx->h, ctx->buf);
+                ctx->used = 0;
+        }
+
+        for (; len >= 128; p += 128, len -= 128)
+                sha512_block (ctx->h, p);
+
+        memcpy (ctx->buf, p, len);
+        ctx->used = len;
+}
+
+
+static void
+sha64_final (sha64_ctx *ctx)
+{
+        ctx->buf[ctx->used++] = 0x80;
+        if (ctx->used > 112) {
+                memset (ctx->buf + ctx->used, 0, 128 - ctx->used);
+                sha512_block (ctx->h, ctx->buf);
+                ctx->used = 0;
+        }
+        memset (ctx->buf + ctx->used, 0, 120 - ctx->used);
+        sha_store64 (ctx->buf + 112, ctx->len >> 61);
+        sha_store64 (ctx->buf + 120, ctx->len << 3);
+        sha512_block (ctx->h, ctx->buf);
+}
+
+
+/* one context for every algorithm, so that callers can pick at runtime */
+
+enum {
+        SHA_1,
+        SHA_224,
+        SHA_256,
+        SHA_384,
+        SHA_512,
+};
+
+
+typedef struct {
+        int             algo;
+        void          (*block) (uint32_t *, const uint8_t *);
+        union {
+                sha32_ctx       c32;
+                sha64_ctx       c64;
+        } u;
+} sha_ctx;
+
+
+static size_t
+sha_digest_len (int algo)
+{
+        switch (algo) {
+        case SHA_1:   return 20;
+        case SHA_224: return 28;
+        case SHA_256: return 32;
+        case SHA_384: return 48;
+        case SHA_512: return 64;
+        }
+
+        return 0;
+}
+
+
+static void
+sha_begin (sha_ctx *ctx, int algo)
+{
+        static const uint32_t iv1[5] = {
+                0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+        };
+        static const uint32_t iv224[8] = {
+                0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939,
+                0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4,
+        };
+        static const uint32_t iv256[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+        };
+        static const uint64_t iv384[8] = {
+                0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL,
+                0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+                0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL,
+                0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+        };
+        static const uint64_t iv512[8] = {
+                0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+                0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+                0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+                0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+        };
+
+        memset (ctx, 0, sizeof (*ctx));
+        ctx->algo = algo;
+
+        switch (algo) {
+        case SHA_1:
+                memcpy (ctx->u.c32.h, iv1, sizeof (iv1));
+                break;
+        case SHA_224:
+                memcpy (ctx->u.c32.h, iv224, sizeof (iv224));
+                ctx->block = sha256_block_pick ();
+                break;
+        case SHA_256:
+                memcpy (ctx->u.c32.h, iv256, sizeof (iv256));
+                ctx->block = sha256_block_pick ();
+                break;
+        case SHA_384:
+                memcpy (ctx->u.c64.h, iv384, sizeof (iv384));
+                break;
+        case SHA_512:
+                memcpy (ctx->u.c64.h, iv512, sizeof (iv512));
+                break;
+        }
+}
+
+
+static void
+sha_update (sha_ctx *ctx, const void *data, size_t len)
+{
+        switch (ctx->algo) {
+        case SHA_1:
+                sha32_update (&ctx->u.c32, sha1_block, data, len);
+                break;
+        case SHA_224:
+        case SHA_256:
+                sha32_update (&ctx->u.c32, ctx->block, data, len);
+                break;
+        default:
+                sha64_update (&ctx->u.c64, data, len);
+                break;
+        }
+}
+
+
+static void
+sha_result (sha_ctx *ctx, uint8_t *out)
+{
+        uint8_t full[64];
+        int     i = 0;
+
+        switch (ctx->algo) {
+        case SHA_1:
+                sha32_final (&ctx->u.c32, sha1_block);
+                for (i = 0; i < 5; i++)
+                        sha_store32 (full + 4 * i, ctx->u.c32.h[i]);
+                break;
+        case SHA_224:
+        case SHA_256:
+                sha32_final (&ctx->u.c32, ctx->block);
+                for (i = 0; i < 8; i++)
+                        sha_store32 (full + 4 * i, ctx->u.c32.h[i]);
+                break;
+        default:
+                sha64_final (&ctx->u.c64);
+                for (i = 0; i < 8; i++)
+                        sha_store64 (full + 8 * i, ctx->u.c64.h[i]);
+                break;
+        }
+
+        memcpy (out, full, sha_digest_len (ctx->algo));
+}
+
+
+/* sha256 of all of @fd from offset 0, read and reported like
+   libevil_md5sum_fd does */
+#define SHA_FD_CHUNK (64 * 1024)
+
+static int
+sha256_fd (int fd, uint8_t *out)
+{
+        sha_ctx  ctx;
+        uint8_t *buf = NULL;
+        off_t    off = 0;
+        ssize_t  n = 0;
+        int      err = 0;
+
+        buf = malloc (SHA_FD_CHUNK);
+        if (!buf)
+                return -1;
+
+        posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        sha_begin (&ctx, SHA_256);
+
+        for (;;) {
+                n = pread (fd, buf, SHA_FD_CHUNK, off);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        break;
+                sha_update (&ctx, buf, n);
+                off += n;
+        }
+
+        err = errno;
+        free (buf);
+
+        if (n < 0) {
+                errno = err;
+                return -1;
+        }
+
+        sha_result (&ctx, out);
+
+        return 0;
+}
+
+#endif /* LE_SHA_C */
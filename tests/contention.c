@@ -0,0 +1,149 @@
+/*
+   Copyright (c) 2011 Gluster, Inc. <http://www.gluster.com>
+   This file is part of GlusterFS.
+
+   GlusterFS is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Affero General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   GlusterFS is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Affero General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+/* how the protected-path checks scale with threads: every thread
+   chmod()s a protected file over and over, which the shim refuses after
+   a check and never hands to the kernel. not part of make check, it
+   needs the shim preloaded and an installed node. make tests/contention
+   builds it:
+
+     LD_PRELOAD=.../libevil.so tests/contention [THREADS [SECONDS [PATH]]]
+
+   the file is given its own mode, so nothing changes if the shim is
+   not there; that is reported and nothing is measured.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+
+struct worker {
+        pthread_t       thread;
+        unsigned long   calls;
+        int             failed;
+        char            pad[64];
+};
+
+
+static const char   *path = "/lic/pubring.gpg";
+static mode_t        mode;
+static volatile int  running = 1;
+
+
+static void *
+hammer (void *data)
+{
+        struct worker *w = data;
+
+        while (running) {
+                if (chmod (path, mode) == 0 || errno != EPERM) {
+                        w->failed = 1;
+                        break;
+                }
+                w->calls++;
+        }
+
+        return NULL;
+}
+
+
+int
+main (int argc, char *argv[])
+{
+        struct worker   *workers = NULL;
+        struct stat      stbuf;
+        struct timespec  start;
+        struct timespec  end;
+        unsigned long    calls = 0;
+        double           secs = 0;
+        int              threads = 4;
+        int              seconds = 5;
+        int              failed = 0;
+        int              i = 0;
+
+        if (argc > 1)
+                threads = atoi (argv[1]);
+        if (argc > 2)
+                seconds = atoi (argv[2]);
+        if (argc > 3)
+                path = argv[3];
+        if (threads < 1 || seconds < 1) {
+                fprintf (stderr, "usage: %s [THREADS [SECONDS [PATH]]]\n",
+                         argv[0]);
+                return 2;
+        }
+
+        if (stat (path, &stbuf) != 0) {
+                fprintf (stderr, "%s: %s\n", path, strerror (errno));
+                return 2;
+        }
+        mode = stbuf.st_mode & 07777;
+
+        if (chmod (path, mode) == 0 || errno != EPERM) {
+                fprintf (stderr, "%s: not refused, is the shim preloaded?\n",
+                         path);
+                return 2;
+        }
+
+        workers = calloc (threads, sizeof (*workers));
+        if (!workers)
+                return 2;
+
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        for (i = 0; i < threads; i++) {
+                if (pthread_create (&workers[i].thread, NULL, hammer,
+                                    &workers[i]) != 0) {
+                        fprintf (stderr, "pthread_create failed\n");
+                        return 2;
+                }
+        }
+
+        sleep (seconds);
+        running = 0;
+
+        for (i = 0; i < threads; i++) {
+                pthread_join (workers[i].thread, NULL);
+                calls += workers[i].calls;
+                failed |= workers[i].failed;
+        }
+        clock_gettime (CLOCK_MONOTONIC, &end);
+
+        if (failed) {
+                fprintf (stderr, "%s: a check let chmod through\n", path);
+                return 1;
+        }
+
+        secs = (end.tv_sec - start.tv_sec) +
+                (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        printf ("%d threads: %lu checks in %.2fs, %.0f/s, %.0f ns each\n",
+                threads, calls, secs, calls / secs,
+                secs * 1e9 * threads / calls);
+
+        free (workers);
+
+        return 0;
+}
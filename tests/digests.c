@@ -0,0 +1,441 @@
+/*
+   Copyright (c) 2011 Gluster, Inc. <http://www.gluster.com>
+   This file is part of GlusterFS.
+
+   GlusterFS is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Affero General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   GlusterFS is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Affero General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+/* sha.c and blake3.c against known answers: the FIPS 180-4 examples and
+   a million "a" for every SHA, SHA-256 and SHA-512 around their padding
+   and block edges, the official BLAKE3 vectors around the 1K chunk
+   edges, and files either side of the size at which blake3_fd starts
+   threads. SHA-224/256 run both through the portable rounds and through
+   whichever sha_begin picks, the cpu's own where it has them.
+
+   the inputs other than the FIPS messages are bytes i % 251, as in the
+   BLAKE3 test vectors.
+*/
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "sha.c"
+#include "blake3.c"
+
+
+#define FIPS_448 "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"
+#define FIPS_896 "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn" \
+                 "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu"
+
+#define BLAKE3_ALGO  -1
+
+
+static const struct {
+        int         algo;
+        const char *in;
+        const char *hex;
+} fips[] = {
+        { SHA_1, "", "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+        { SHA_1, "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+        { SHA_1, FIPS_448, "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+        { SHA_224, "", "d14a028c2a3a2bc9476102bb288234c4"
+                       "15a2b01f828ea62ac5b3e42f" },
+        { SHA_224, "abc", "23097d223405d8228642a477bda255b3"
+                          "2aadbce4bda0b3f7e36c9da7" },
+        { SHA_224, FIPS_448, "75388b16512776cc5dba5da1fd890150"
+                             "b0c6455cb4f58b1952522525" },
+        { SHA_256, "", "e3b0c44298fc1c149afbf4c8996fb924"
+                       "27ae41e4649b934ca495991b7852b855" },
+        { SHA_256, "abc", "ba7816bf8f01cfea414140de5dae2223"
+                          "b00361a396177a9cb410ff61f20015ad" },
+        { SHA_256, FIPS_448, "248d6a61d20638b8e5c026930c3e6039"
+                             "a33ce45964ff2167f6ecedd419db06c1" },
+        { SHA_384, "", "38b060a751ac96384cd9327eb1b1e36a"
+                       "21fdb71114be07434c0cc7bf63f6e1da"
+                       "274edebfe76f65fbd51ad2f14898b95b" },
+        { SHA_384, "abc", "cb00753f45a35e8bb5a03d699ac65007"
+                          "272c32ab0eded1631a8b605a43ff5bed"
+                          "8086072ba1e7cc2358baeca134c825a7" },
+        { SHA_384, FIPS_896, "09330c33f71147e83d192fc782cd1b47"
+                             "53111b173b3b05d22fa08086e3b0f712"
+                             "fcc7c71a557e2db966c3e9fa91746039" },
+        { SHA_512, "", "cf83e1357eefb8bdf1542850d66d8007"
+                       "d620e4050b5715dc83f4a921d36ce9ce"
+                       "47d0d13c5d85f2b0ff8318d2877eec2f"
+                       "63b931bd47417a81a538327af927da3e" },
+        { SHA_512, "abc", "ddaf35a193617abacc417349ae204131"
+                          "12e6fa4e89a97ea20a9eeee64b55d39a"
+                          "2192992a274fc1a836ba3c23a3feebbd"
+                          "454d4423643ce80e2a9ac94fa54ca49f" },
+        { SHA_512, FIPS_896, "8e959b75dae313da8cf4f72814fc143f"
+                             "8f7779c6eb9f7fa17299aeadb6889018"
+                             "501d289e4900f7e4331b99dec4b5433a"
+                             "c7d329eeb6dd26545e96e55b874be909" },
+};
+
+
+static const struct {
+        int         algo;
+        const char *hex;
+} million[] = {
+        { SHA_1, "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+        { SHA_224, "20794655980c91d8bbb4c1ea97618a4b"
+                   "f03f42581948b2ee4ee7ad67" },
+        { SHA_256, "cdc76e5c9914fb9281a1c7e284d73e67"
+                   "f1809a48a497200e046d39ccc7112cd0" },
+        { SHA_384, "9d0e1809716474cb086e834e310a4a1c"
+                   "ed149e9c00f248527972cec5704c2a5b"
+                   "07b8b3dc38ecc4ebae97ddd87f3d8985" },
+        { SHA_512, "e718483d0ce769644e2e42c7bc15b463"
+                   "8e1f98b13b2044285632a803afa973eb"
+                   "de0ff244877ea60a4cb0432ce577c31b"
+                   "eb009c5c2c49aa2e4eadb217ad8cc09b" },
+};
+
+
+static const struct {
+        int         algo;
+        size_t      len;
+        const char *hex;
+} edges[] = {
+        { SHA_256,  55, "463eb28e72f82e0a96c0a4cc53690c57"
+                        "1281131f672aa229e0d45ae59b598b59" },
+        { SHA_256,  56, "da2ae4d6b36748f2a318f23e7ab1dfdf"
+                        "45acdc9d049bd80e59de82a60895f562" },
+        { SHA_256,  63, "29af2686fd53374a36b0846694cc3421"
+                        "77e428d1647515f078784d69cdb9e488" },
+        { SHA_256,  64, "fdeab9acf3710362bd2658cdc9a29e8f"
+                        "9c757fcf9811603a8c447cd1d9151108" },
+        { SHA_256,  65, "4bfd2c8b6f1eec7a2afeb48b934ee4b2"
+                        "694182027e6d0fc075074f2fabb31781" },
+        { SHA_512, 111, "a1a111449b198d9b1f538bad7f3fc102"
+                        "2b3a5b1a5e90a0bc860de8512746cbc3"
+                        "1599e6c834de3a3235327af0b51ff57b"
+                        "f7acf1974a73014d9c3953812edc7c8d" },
+        { SHA_512, 112, "c5fbd731d19d2ae1180f001be72c2c1a"
+                        "aba1d7b094b3748880e24593b8e117a7"
+                        "50e11c1bd867cc2f96dace8c8b74abd2"
+                        "d5c4f236be444e77d30d1916174070b9" },
+        { SHA_512, 127, "eab89674feaa34e27aebeeff3c0a4d70"
+                        "070bb872d5e9f186cf1dbbdee517b6e3"
+                        "5724d629ff025a5b07185e911ada7e3c"
+                        "8acf830aa0e4f71777bd2d44f504f7f0" },
+        { SHA_512, 128, "1dffd5e3adb71d45d2245939665521ae"
+                        "001a317a03720a45732ba1900ca3b835"
+                        "1fc5c9b4ca513eba6f80bc7b1d1fdad4"
+                        "abd13491cb824d61b08d8c0e1561b3f7" },
+        { SHA_512, 129, "1d9da57fbbdab09afb3506ab2d223d06"
+                        "109d65c1c8ad197f50138f714bc4c3f2"
+                        "fe5787922639c680acad1c651f955990"
+                        "425954ce2cba0c5cc83f2667d878eb0f" },
+};
+
+
+/* the official test_vectors.json, unkeyed, first 32 bytes of output */
+static const struct {
+        size_t      len;
+        const char *hex;
+} blake3[] = {
+        {      0, "af1349b9f5f9a1a6a0404dea36dcc949"
+                  "9bcb25c9adc112b7cc9a93cae41f3262" },
+        {      1, "2d3adedff11b61f14c886e35afa03673"
+                  "6dcd87a74d27b5c1510225d0f592e213" },
+        {   1023, "10108970eeda3eb932baac1428c7a216"
+                  "3b0e924c9a9e25b35bba72b28f70bd11" },
+        {   1024, "42214739f095a406f3fc83deb889744a"
+                  "c00df831c10daa55189b5d121c855af7" },
+        {   1025, "d00278ae47eb27b34faecf67b4fe263f"
+                  "82d5412916c1ffd97c8cb7fb814b8444" },
+        {   2048, "e776b6028c7cd22a4d0ba182a8bf6220"
+                  "5d2ef576467e838ed6f2529b85fba24a" },
+        {   2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3"
+                  "c2ef86c426c95c1af0b6879522563030" },
+        {   3072, "b98cb0ff3623be03326b373de6b90952"
+                  "18513e64f1ee2edd2525c7ad1e5cffd2" },
+        {   3073, "7124b49501012f81cc7f11ca069ec922"
+                  "6cecb8a2c850cfe644e327d22d3e1cd3" },
+        {   4096, "015094013f57a5277b59d8475c050104"
+                  "2c0b642e531b0a1c8f58d2163229e969" },
+        {   4097, "9b4052b38f1c5fc8b1f9ff7ac7b27cd2"
+                  "42487b3d890d15c96a1c25b8aa0fb995" },
+        {   5120, "9cadc15fed8b5d854562b26a9536d970"
+                  "7cadeda9b143978f319ab34230535833" },
+        {   5121, "628bd2cb2004694adaab7bbd778a25df"
+                  "25c47b9d4155a55f8fbd79f2fe154cff" },
+        {   6144, "3e2e5b74e048f3add6d21faab3f83aa4"
+                  "4d3b2278afb83b80b3c35164ebeca205" },
+        {   6145, "f1323a8631446cc50536a9f705ee5cb6"
+                  "19424d46887f3c376c695b70e0f0507f" },
+        {   7168, "61da957ec2499a95d6b8023e2b0e604e"
+                  "c7f6b50e80a9678b89d2628e99ada77a" },
+        {   7169, "a003fc7a51754a9b3c7fae0367ab3d78"
+                  "2dccf28855a03d435f8cfe74605e7817" },
+        {   8192, "aae792484c8efe4f19e2ca7d371d8c46"
+                  "7ffb10748d8a5a1ae579948f718a2a63" },
+        {   8193, "bab6c09cb8ce8cf459261398d2e7aef3"
+                  "5700bf488116ceb94a36d0f5f1b7bc3b" },
+        {  16384, "f875d6646de28985646f34ee13be9a57"
+                  "6fd515f76b5b0a26bb324735041ddde4" },
+        {  31744, "62b6960e1a44bcc1eb1a611a8d6235b6"
+                  "b4b78f32e7abc4fb4c6cdcce94895c47" },
+        { 102400, "bc3e3d41a1146b069abffad3c0d44860"
+                  "cf664390afce4d9661f7902e7943e085" },
+};
+
+
+/* around BLAKE3_PAR_MIN, and segments not ending on a chunk */
+static const struct {
+        size_t      len;
+        const char *sha256;
+        const char *blake3;
+} files[] = {
+        { 4194303, "8bc25f24c0f447466930cda6b0ac7405"
+                   "adc7f6348c50204caa9f9a5b6217ed42",
+                   "6ee7f30ae33570aae744290e3f678050"
+                   "511e72f37e594d7620a9191c7d353dd9" },
+        { 4194304, "a117210941a0b00dcb2d8577e680d84b"
+                   "6fa0eaf760d2afc654c953b9859d54fa",
+                   "4e94e6f582581a0f3855f3ce504b153e"
+                   "951e65036fe9e2f010b7e25473c54f98" },
+        { 4194305, "f4711f6bc42a8dc6520e30e306743855"
+                   "a82c7bdecd6e7d3edfb04b6f4524f7bd",
+                   "0460893a0170917e0d568bb27c028798"
+                   "4d4f7e9d59eafb95e6fb3c01ec611eab" },
+        { 5243903, "217d5541688db5a05d5f4059b3e2bccf"
+                   "0b0a956b155be83a5d8e778cc727b161",
+                   "c574b97d02d42d4f1f779e74b7959aae"
+                   "8e1705f22f8dfc83f72841fab2d4323f" },
+        { 9441281, "ff93567538fba4bd3c44d2fab5fd4acb"
+                   "a39b3a5477d6712c19e9ef89c02da478",
+                   "f82d77daf2fbd606393a430e9f3c18b0"
+                   "cfb222ced1112e864bc6cb0c53b7731a" },
+};
+
+
+static const char *
+algo_name (int algo)
+{
+        switch (algo) {
+        case SHA_1:       return "sha1";
+        case SHA_224:     return "sha224";
+        case SHA_256:     return "sha256";
+        case SHA_384:     return "sha384";
+        case SHA_512:     return "sha512";
+        case BLAKE3_ALGO: return "blake3";
+        }
+
+        return "?";
+}
+
+
+static int
+check (const char *what, const uint8_t *digest, size_t len, const char *want)
+{
+        char   got[2 * 64 + 1];
+        size_t i = 0;
+
+        for (i = 0; i < len; i++)
+                sprintf (got + 2 * i, "%02x", digest[i]);
+
+        if (strcmp (got, want) == 0)
+                return 0;
+
+        printf ("FAIL %s: expected %s, got %s\n", what, want, got);
+        return 1;
+}
+
+
+/* @buf fed @piece bytes at a time, all at once if 0; @portable keeps
+   SHA-224/256 off the cpu's rounds */
+static int
+check_buf (int algo, const char *what, const uint8_t *buf, size_t len,
+           size_t piece, int portable, const char *want)
+{
+        sha_ctx    ctx;
+        blake3_ctx b3;
+        uint8_t    digest[64];
+        char       name[128];
+        char       how[48] = "whole";
+        size_t     n = 0;
+
+        if (piece)
+                snprintf (how, sizeof (how), "in %zu byte pieces", piece);
+        else
+                piece = len ? len : 1;
+
+        snprintf (name, sizeof (name), "%s%s of %s %s", algo_name (algo),
+                  portable ? " (portable)" : "", what, how);
+
+        if (algo == BLAKE3_ALGO) {
+                blake3_begin (&b3, 0);
+                for (; len; buf += n, len -= n) {
+                        n = len < piece ? len : piece;
+                        blake3_update (&b3, buf, n);
+                }
+                blake3_result (&b3, digest);
+                return check (name, digest, BLAKE3_OUT_LEN, want);
+        }
+
+        sha_begin (&ctx, algo);
+        if (portable)
+                ctx.block = sha256_block;
+        for (; len; buf += n, len -= n) {
+                n = len < piece ? len : piece;
+                sha_update (&ctx, buf, n);
+        }
+        sha_result (&ctx, digest);
+
+        return check (name, digest, sha_digest_len (algo), want);
+}
+
+
+/* whole, byte by byte and in pieces straddling blocks and chunks, and
+   again through the portable rounds where there is a choice */
+static int
+check_all (int algo, const char *what, const uint8_t *buf, size_t len,
+           const char *want, int *tests)
+{
+        static const size_t pieces[] = { 0, 1, 1023 };
+        size_t              i = 0;
+        int                 portable = 0;
+        int                 failed = 0;
+
+        for (portable = 0; portable < 2; portable++) {
+                if (portable && algo != SHA_224 && algo != SHA_256)
+                        break;
+                for (i = 0; i < sizeof (pieces) / sizeof (pieces[0]); i++) {
+                        failed += check_buf (algo, what, buf, len, pieces[i],
+                                             portable, want);
+                        (*tests)++;
+                }
+        }
+
+        return failed;
+}
+
+
+static int
+check_file (const uint8_t *buf, size_t len, const char *sha256,
+            const char *b3)
+{
+        uint8_t  digest[32];
+        char     path[] = "/tmp/digests.XXXXXX";
+        char     what[64];
+        int      fd = -1;
+        int      failed = 0;
+
+        snprintf (what, sizeof (what), "file of %zu bytes", len);
+
+        fd = mkstemp (path);
+        if (fd == -1) {
+                printf ("FAIL %s: %s\n", what, strerror (errno));
+                return 2;
+        }
+        unlink (path);
+
+        if (write (fd, buf, len) != (ssize_t) len) {
+                printf ("FAIL %s: %s\n", what, strerror (errno));
+                close (fd);
+                return 2;
+        }
+
+        if (sha256_fd (fd, digest) != 0) {
+                printf ("FAIL sha256_fd %s: %s\n", what, strerror (errno));
+                failed++;
+        } else {
+                failed += check (what, digest, 32, sha256);
+        }
+
+        if (blake3_fd (fd, digest) != 0) {
+                printf ("FAIL blake3_fd %s: %s\n", what, strerror (errno));
+                failed++;
+        } else {
+                failed += check (what, digest, BLAKE3_OUT_LEN, b3);
+        }
+
+        close (fd);
+
+        return failed;
+}
+
+
+int
+main (int argc, char *argv[])
+{
+        uint8_t  *buf = NULL;
+        size_t    size = 0;
+        char      what[64];
+        size_t    i = 0;
+        int       tests = 0;
+        int       failed = 0;
+
+        for (i = 0; i < sizeof (files) / sizeof (files[0]); i++)
+                if (files[i].len > size)
+                        size = files[i].len;
+        if (size < 1000000)
+                size = 1000000;
+
+        buf = malloc (size);
+        if (!buf) {
+                printf ("FAIL: %s\n", strerror (errno));
+                return 1;
+        }
+
+        printf ("sha256: %s rounds\n",
+                sha256_block_pick () == sha256_block ? "portable" : "cpu");
+
+        for (i = 0; i < sizeof (fips) / sizeof (fips[0]); i++) {
+                snprintf (what, sizeof (what), "\"%.16s\"", fips[i].in);
+                failed += check_all (fips[i].algo, what,
+                                     (const uint8_t *) fips[i].in,
+                                     strlen (fips[i].in), fips[i].hex, &tests);
+        }
+
+        memset (buf, 'a', 1000000);
+        for (i = 0; i < sizeof (million) / sizeof (million[0]); i++)
+                failed += check_all (million[i].algo, "a million \"a\"",
+                                     buf, 1000000, million[i].hex, &tests);
+
+        for (i = 0; i < size; i++)
+                buf[i] = i % 251;
+
+        for (i = 0; i < sizeof (edges) / sizeof (edges[0]); i++) {
+                snprintf (what, sizeof (what), "%zu bytes", edges[i].len);
+                failed += check_all (edges[i].algo, what, buf, edges[i].len,
+                                     edges[i].hex, &tests);
+        }
+
+        for (i = 0; i < sizeof (blake3) / sizeof (blake3[0]); i++) {
+                snprintf (what, sizeof (what), "%zu bytes", blake3[i].len);
+                failed += check_all (BLAKE3_ALGO, what, buf, blake3[i].len,
+                                     blake3[i].hex, &tests);
+        }
+
+        for (i = 0; i < sizeof (files) / sizeof (files[0]); i++) {
+                failed += check_file (buf, files[i].len, files[i].sha256,
+                                      files[i].blake3);
+                tests += 2;
+        }
+
+        free (buf);
+
+        printf ("%d tests, %d failed\n", tests, failed);
+
+        return failed ? 1 : 0;
+}
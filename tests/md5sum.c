@@ -0,0 +1,216 @@
+/*
+   Copyright (c) 2011 Gluster, Inc. <http://www.gluster.com>
+   This file is part of GlusterFS.
+
+   GlusterFS is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Affero General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   GlusterFS is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Affero General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+/* md5.c against known answers: the RFC 1321 test suite, runs of "a"
+   either side of the 55/56 byte padding split and the block edges, a
+   million "a" fed in pieces that straddle blocks, and files around the
+   64K read size of libevil_md5sum_fd.
+*/
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "md5.c"
+
+
+static const struct {
+        const char *in;
+        const char *md5;
+} rfc1321[] = {
+        { "", "d41d8cd98f00b204e9800998ecf8427e" },
+        { "a", "0cc175b9c0f1b6a831c399e269772661" },
+        { "abc", "900150983cd24fb0d6963f7d28e17f72" },
+        { "message digest", "f96b697d7cb7938d525a2f31aaf161d0" },
+        { "abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b" },
+        { "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+          "d174ab98d277d9f5a5611c2c9f419d9f" },
+        { "1234567890123456789012345678901234567890"
+          "1234567890123456789012345678901234567890",
+          "57edf4a22be3c955ac49da2e2107b67a" },
+};
+
+
+static const struct {
+        size_t      len;
+        const char *md5;
+} runs[] = {
+        {  55, "ef1772b6dff9a122358552954ad0df65" },
+        {  56, "3b0c8ac703f828b04c6c197006d17218" },
+        {  57, "652b906d60af96844ebd21b674f35e93" },
+        {  63, "b06521f39153d618550606be297466d5" },
+        {  64, "014842d480b571495a4a0363793f7367" },
+        {  65, "c743a45e0d2e6a95cb859adae0248435" },
+        { 119, "8a7bd0732ed6a28ce75f6dabc90e1613" },
+        { 120, "5f61c0ccad4cac44c75ff505e1f1e537" },
+        { 127, "020406e1d05cdc2aa287641f7ae2cc39" },
+        { 128, "e510683b3f5ffe4093d021808bc6ff70" },
+        { 129, "b325dc1c6f5e7a2b7cf465b9feab7948" },
+};
+
+
+/* byte i of the files is (i * 31 + i / 512) & 0xff */
+static const struct {
+        size_t      len;
+        const char *md5;
+} files[] = {
+        {      0, "d41d8cd98f00b204e9800998ecf8427e" },
+        {      1, "93b885adfe0da089cdf634904fd59f71" },
+        {  65535, "beb5966270daed2409415da533a9008b" },
+        {  65536, "e224673b9fff712cb437be57cc388169" },
+        {  65537, "621116b89667f578754a1269b534b4f5" },
+        { 200003, "bac9a0d4c5a9083828cf75a35f302e7b" },
+};
+
+
+static int
+check (const char *what, const uint8_t *digest, const char *want)
+{
+        char got[2 * MD5_DIGEST_LEN + 1];
+        int  i = 0;
+
+        for (i = 0; i < MD5_DIGEST_LEN; i++)
+                sprintf (got + 2 * i, "%02x", digest[i]);
+
+        if (strcmp (got, want) == 0)
+                return 0;
+
+        printf ("FAIL %s: expected %s, got %s\n", what, want, got);
+        return 1;
+}
+
+
+static int
+check_buf (const char *what, const uint8_t *buf, size_t len, size_t piece,
+           const char *want)
+{
+        md_context ctx;
+        uint8_t    digest[MD5_DIGEST_LEN];
+        size_t     n = 0;
+
+        md5_begin (&ctx);
+        for (; len; buf += n, len -= n) {
+                n = len < piece ? len : piece;
+                md5_update (&ctx, buf, n);
+        }
+        md5_result (&ctx, digest);
+
+        return check (what, digest, want);
+}
+
+
+static int
+check_file (size_t len, const char *want)
+{
+        uint8_t *buf = NULL;
+        uint8_t  digest[MD5_DIGEST_LEN];
+        char     path[] = "/tmp/md5sum.XXXXXX";
+        char     what[64];
+        size_t   i = 0;
+        int      fd = -1;
+        int      failed = 0;
+
+        snprintf (what, sizeof (what), "file of %zu bytes", len);
+
+        buf = malloc (len + 1);
+        fd = mkstemp (path);
+        if (!buf || fd == -1) {
+                printf ("FAIL %s: %s\n", what, strerror (errno));
+                free (buf);
+                return 1;
+        }
+        unlink (path);
+
+        for (i = 0; i < len; i++)
+                buf[i] = i * 31 + i / 512;
+
+        /* the digest starts at 0 and leaves the file position alone */
+        if (write (fd, buf, len) != (ssize_t) len ||
+            lseek (fd, len / 2, SEEK_SET) != (off_t) (len / 2)) {
+                printf ("FAIL %s: %s\n", what, strerror (errno));
+                failed = 1;
+        } else if (libevil_md5sum_fd (fd, digest) != 0) {
+                printf ("FAIL %s: %s\n", what, strerror (errno));
+                failed = 1;
+        } else {
+                failed = check (what, digest, want);
+                if (lseek (fd, 0, SEEK_CUR) != (off_t) (len / 2)) {
+                        printf ("FAIL %s: file position moved\n", what);
+                        failed = 1;
+                }
+        }
+
+        close (fd);
+        free (buf);
+
+        return failed;
+}
+
+
+int
+main (int argc, char *argv[])
+{
+        uint8_t  *buf = NULL;
+        char      what[64];
+        size_t    i = 0;
+        int       tests = 0;
+        int       failed = 0;
+
+        for (i = 0; i < sizeof (rfc1321) / sizeof (rfc1321[0]); i++) {
+                snprintf (what, sizeof (what), "\"%.16s\"", rfc1321[i].in);
+                failed += check_buf (what, (const uint8_t *) rfc1321[i].in,
+                                     strlen (rfc1321[i].in), 64,
+                                     rfc1321[i].md5);
+                tests++;
+        }
+
+        buf = malloc (1000000);
+        if (!buf) {
+                printf ("FAIL: %s\n", strerror (errno));
+                return 1;
+        }
+        memset (buf, 'a', 1000000);
+
+        for (i = 0; i < sizeof (runs) / sizeof (runs[0]); i++) {
+                snprintf (what, sizeof (what), "%zu \"a\"", runs[i].len);
+                failed += check_buf (what, buf, runs[i].len, runs[i].len,
+                                     runs[i].md5);
+                /* the same, byte by byte through the context's buffer */
+                failed += check_buf (what, buf, runs[i].len, 1,
+                                     runs[i].md5);
+                tests += 2;
+        }
+
+        failed += check_buf ("a million \"a\"", buf, 1000000, 997,
+                             "7707d6ae4e027c70eea2a935c2296f21");
+        tests++;
+        free (buf);
+
+        for (i = 0; i < sizeof (files) / sizeof (files[0]); i++) {
+                failed += check_file (files[i].len, files[i].md5);
+                tests++;
+        }
+
+        printf ("%d tests, %d failed\n", tests, failed);
+
+        return failed ? 1 : 0;
+}
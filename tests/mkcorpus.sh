@@ -0,0 +1,152 @@
+#!/bin/bash
+
+# rebuild tests/pgp: clearsign a permit file with fresh keys, mutate the
+# results and record, for each file, gpgv's verdict next to the one
+# pgpverify (built from tests/pgpverify.c) gives. a file on which the
+# two disagree is an error, not something to record.
+#
+#   tests/mkcorpus.sh ./pgpverify
+
+set -e;
+
+pgpverify=$(readlink -f "$1");
+dir=$(cd $(dirname "$0") && pwd)/pgp;
+export GNUPGHOME=$(mktemp -d);
+trap 'rm -rf "$GNUPGHOME"' EXIT;
+
+keys="1024:SHA1 2048:SHA224 2048:SHA256 3072:SHA384 4096:SHA512";
+
+
+function genkey ()
+{
+    local bits="$1";
+    local name="$2";
+
+    gpg --batch --quiet --gen-key <<EOK
+%no-protection
+Key-Type: RSA
+Key-Length: $bits
+Key-Usage: sign
+Name-Real: $name
+Expire-Date: 0
+%commit
+EOK
+}
+
+
+function permits ()
+{
+    echo "sha256:$(echo gpgv | sha256sum | cut -f1 -d' ') /lic/gpgv";
+    echo "sha256:$(echo libevil | sha256sum | cut -f1 -d' ') /lib64/libevil64.so";
+    echo "sha256:$(echo pubring | sha256sum | cut -f1 -d' ') /lic/pubring.gpg";
+}
+
+
+function sign ()
+{
+    local name="$1";
+    local hash="$2";
+
+    gpg --batch --quiet --local-user "$name" --digest-algo "$hash" --clearsign;
+}
+
+
+# the signature packet with its last byte, part of the RSA value, flipped.
+# the CRC is left out, so that only the signature itself can fail
+function flipsig ()
+{
+    local file="$1";
+    local raw=$(mktemp);
+
+    sed -n '/^-----BEGIN PGP SIGNATURE/,/^-----END/p' "$file" |
+        sed '1,/^$/d; /^=/d; /^-----END/d' | base64 -d > "$raw";
+    printf "$(printf '\\%03o' $(( $(tail -c 1 "$raw" | od -An -tu1) ^ 1 )))" |
+        dd of="$raw" bs=1 seek=$(( $(stat -c %s "$raw") - 1 )) \
+           conv=notrunc 2>/dev/null;
+
+    sed '/^-----BEGIN PGP SIGNATURE/,$d' "$file";
+    echo "-----BEGIN PGP SIGNATURE-----";
+    echo;
+    base64 -w 64 "$raw";
+    echo "-----END PGP SIGNATURE-----";
+    rm -f "$raw";
+}
+
+
+function mutate ()
+{
+    local tag="$1";
+    local name="$2";
+    local hash="$3";
+    local other=SHA1;
+    local good="$dir/$tag-good.asc";
+
+    [ "$hash" = SHA1 ] && other=SHA256;
+
+    permits | sign "$name" "$hash" > "$good";
+    sed '0,/lic/s/lic/lid/' "$good" > "$dir/$tag-text.asc";
+    sed '4s/$/  \t /' "$good" > "$dir/$tag-blanks.asc";
+    sed 's/$/\r/' "$good" > "$dir/$tag-crlf.asc";
+    (permits; echo "- dashed"; echo "-----BEGIN not armor") |
+        sign "$name" "$hash" > "$dir/$tag-dash.asc";
+    printf '' | sign "$name" "$hash" > "$dir/$tag-empty.asc";
+    sed '/^=/{/^=AAAA/s/.*/=BBBB/;t;s/.*/=AAAA/}' "$good" > "$dir/$tag-crc.asc";
+    sed '/^=/d' "$good" > "$dir/$tag-nocrc.asc";
+    flipsig "$good" > "$dir/$tag-sigbit.asc";
+    sed "s/^Hash: .*/Hash: $other/" "$good" > "$dir/$tag-hashother.asc";
+    sed "s/^Hash: .*/Hash: $other,$hash/" "$good" > "$dir/$tag-hashlist.asc";
+    sed "s/^Hash: .*/Hash: $other , $hash /" "$good" > "$dir/$tag-hashspaces.asc";
+    sed '/^Hash: /d' "$good" > "$dir/$tag-nohash.asc";
+    sed "s/^Hash: .*/Hash: ${hash,,}/" "$good" > "$dir/$tag-hashlower.asc";
+    (echo "junk"; cat "$good") > "$dir/$tag-junk.asc";
+}
+
+
+function main ()
+{
+    local key;
+    local bits;
+    local hash;
+    local file;
+    local gpgv;
+    local ours;
+
+    rm -f "$dir"/*.asc "$dir"/pubring.gpg "$dir"/verdicts;
+    mkdir -p "$dir";
+
+    for key in $keys; do
+        bits=${key%:*};
+        hash=${key#*:};
+        genkey $bits "corpus-rsa$bits-${hash,,}";
+    done
+    gpg --batch --quiet --export > "$dir/pubring.gpg";
+
+    for key in $keys; do
+        bits=${key%:*};
+        hash=${key#*:};
+        mutate "rsa$bits-${hash,,}" "corpus-rsa$bits-${hash,,}" $hash;
+    done
+
+    # signed by a key pubring.gpg does not have
+    genkey 2048 corpus-unknown;
+    permits | sign corpus-unknown SHA256 > "$dir/unknown.asc";
+
+    echo "# file, gpgv's verdict, pgp.c's (gpgv: left to gpgv)" > "$dir/verdicts";
+    for file in "$dir"/*.asc; do
+        if gpgv --keyring "$dir/pubring.gpg" "$file" >/dev/null 2>&1; then
+            gpgv=good;
+        else
+            gpgv=bad;
+        fi
+        ours=$("$pgpverify" "$dir/pubring.gpg" "$file");
+        if [ "$ours" = yes -a $gpgv = bad ] ||
+           [ "$ours" = no -a $gpgv = good ]; then
+            echo "$(basename $file): gpgv says $gpgv, pgp.c $ours" >&2;
+            exit 1;
+        fi
+        echo "$(basename $file) $gpgv $ours" >> "$dir/verdicts";
+    done
+}
+
+
+main "$@";
@@ -0,0 +1,163 @@
+/*
+   Copyright (c) 2011 Gluster, Inc. <http://www.gluster.com>
+   This file is part of GlusterFS.
+
+   GlusterFS is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Affero General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   GlusterFS is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Affero General Public License for more details.
+
+   You should have received a copy of the GNU Affero General Public License
+   along with this program.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+/* pgp_verify_clearsign against the corpus in tests/pgp, whose verdicts
+   file records for each clearsigned file what gpgv said of it and what
+   pgp.c answers: "yes" and "no" have to agree with gpgv, "gpgv" is a
+   file left to it. mkcorpus.sh rebuilds the corpus with this program:
+
+     pgpverify                  check every file of the corpus
+     pgpverify KEYRING FILE     print the verdict on one file
+*/
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libevil.h"
+#include "pgp.c"
+
+
+static char *
+slurp (const char *path, size_t *lenp)
+{
+        FILE   *fp = NULL;
+        char   *buf = NULL;
+        char   *tmp = NULL;
+        size_t  len = 0;
+        size_t  n = 0;
+
+        fp = fopen (path, "rb");
+        if (!fp) {
+                fprintf (stderr, "%s: %s\n", path, strerror (errno));
+                return NULL;
+        }
+
+        for (;;) {
+                tmp = realloc (buf, len + 4096);
+                if (!tmp) {
+                        free (buf);
+                        fclose (fp);
+                        return NULL;
+                }
+                buf = tmp;
+
+                n = fread (buf + len, 1, 4096, fp);
+                len += n;
+                if (n < 4096)
+                        break;
+        }
+
+        fclose (fp);
+        *lenp = len;
+
+        return buf;
+}
+
+
+static const char *
+verdict (const char *keyring, const char *path)
+{
+        char   *key = NULL;
+        char   *buf = NULL;
+        size_t  keylen = 0;
+        size_t  len = 0;
+        int     ret = -1;
+
+        key = slurp (keyring, &keylen);
+        buf = slurp (path, &len);
+        if (!key || !buf) {
+                free (key);
+                free (buf);
+                return NULL;
+        }
+
+        ret = pgp_verify_clearsign (buf, len, (uint8_t *) key, keylen);
+
+        free (key);
+        free (buf);
+
+        return ret == YES ? "yes" : ret == NO ? "no" : "gpgv";
+}
+
+
+int
+main (int argc, char *argv[])
+{
+        const char *srcdir = NULL;
+        const char *got = NULL;
+        char        dir[2048];
+        char        keyring[4096];
+        char        path[4096];
+        char        line[512];
+        char        name[256];
+        char        gpgv[16];
+        char        want[16];
+        FILE       *fp = NULL;
+        int         files = 0;
+        int         failed = 0;
+
+        if (argc == 3) {
+                got = verdict (argv[1], argv[2]);
+                if (!got)
+                        return 2;
+                printf ("%s\n", got);
+                return 0;
+        }
+
+        srcdir = getenv ("srcdir");
+        snprintf (dir, sizeof (dir), "%s/tests/pgp", srcdir ? srcdir : ".");
+        snprintf (keyring, sizeof (keyring), "%s/pubring.gpg", dir);
+        snprintf (path, sizeof (path), "%s/verdicts", dir);
+
+        fp = fopen (path, "r");
+        if (!fp) {
+                fprintf (stderr, "%s: %s\n", path, strerror (errno));
+                return 1;
+        }
+
+        while (fgets (line, sizeof (line), fp)) {
+                if (line[0] == '#' || line[0] == '\n')
+                        continue;
+                if (sscanf (line, "%255s %15s %15s", name, gpgv, want) != 3) {
+                        fprintf (stderr, "verdicts: bad line: %s", line);
+                        failed++;
+                        continue;
+                }
+
+                snprintf (path, sizeof (path), "%s/%s", dir, name);
+                got = verdict (keyring, path);
+                files++;
+
+                if (!got || strcmp (got, want) != 0 ||
+                    (!strcmp (got, "yes") && strcmp (gpgv, "good")) ||
+                    (!strcmp (got, "no") && strcmp (gpgv, "bad"))) {
+                        printf ("FAIL %s: gpgv %s, expected %s, got %s\n",
+                                name, gpgv, want, got ? got : "error");
+                        failed++;
+                }
+        }
+        fclose (fp);
+
+        printf ("%d files, %d failed\n", files, failed);
+
+        return (failed || !files) ? 1 : 0;
+}